@@ -35,6 +35,7 @@ int
 main (int argc, char *argv[])
 {
   pinentry_init ("pinentry-curses");
+  pinentry_set_features (PINENTRY_CURSES_FEATURES);
 
   pinentry_parse_opts (argc, argv);
 
@@ -566,8 +566,12 @@ efl_cmd_handler (pinentry_t pe)
    */
   if (pe->display)
     ecore_x_init (pe->display);
+  pinentry_trace_begin ("elm-init");
   elm_init (pargc, pargv);
+  pinentry_trace_end ("elm-init");
+  pinentry_trace_begin ("create-window");
   create_window ();
+  pinentry_trace_end ("create-window");
   ecore_main_loop_begin ();
 
   if (timer)
@@ -595,6 +599,7 @@ int
 main (int argc, char *argv[])
 {
   pinentry_init (PGMNAME);
+  pinentry_set_features (PINENTRY_FEATURE_QUALITY_BAR);
 
 #ifdef FALLBACK_CURSES
   if (pinentry_have_display (argc, argv))
@@ -610,6 +615,7 @@ main (int argc, char *argv[])
   else
     {
       pinentry_cmd_handler = curses_cmd_handler;
+      pinentry_set_features (PINENTRY_CURSES_FEATURES);
     }
 #endif
 
@@ -328,10 +328,14 @@ int main(int argc, char *argv[])
 {
 	application = *argv;
 	pinentry_init(PGMNAME);
+	pinentry_set_features(PINENTRY_FEATURE_QUALITY_BAR);
 
 #ifdef FALLBACK_CURSES
 	if (!pinentry_have_display(argc, argv))
+	{
 		pinentry_cmd_handler = curses_cmd_handler;
+		pinentry_set_features(PINENTRY_CURSES_FEATURES);
+	}
 	else
 #endif
 	{
@@ -517,14 +517,17 @@ int
 main (int argc, char *argv[])
 {
   pinentry_init (PGMNAME);
+  pinentry_set_features (PINENTRY_FEATURE_EXTERNAL_CACHE);
 
 #ifdef FALLBACK_CURSES
+  pinentry_trace_begin ("probe-prompter");
   if (!getenv ("DBUS_SESSION_BUS_ADDRESS"))
     {
       fprintf (stderr, "No $DBUS_SESSION_BUS_ADDRESS found,"
                " falling back to curses\n");
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
+      pinentry_set_features (PINENTRY_CURSES_FEATURES);
     }
   else if (!pe_gcr_system_prompt_available ())
     {
@@ -532,6 +535,7 @@ main (int argc, char *argv[])
                " falling back to curses\n");
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
+      pinentry_set_features (PINENTRY_CURSES_FEATURES);
     }
   else if (pe_gnome_screen_locked ())
     {
@@ -539,7 +543,9 @@ main (int argc, char *argv[])
                " falling back to curses\n");
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
+      pinentry_set_features (PINENTRY_CURSES_FEATURES);
     }
+  pinentry_trace_end ("probe-prompter");
 #endif
 
   pinentry_parse_opts (argc, argv);
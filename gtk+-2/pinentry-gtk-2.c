@@ -70,9 +70,13 @@ static GtkWindow *mainwindow;
 static GtkWidget *entry;
 static GtkWidget *repeat_entry;
 static GtkWidget *error_label;
+static GtkWidget *message_box;  /* The box the error label goes into.  */
+static gint error_label_position;
 static GtkWidget *qualitybar;
 static gboolean got_input;
 static guint timeout_source;
+static guint live_source;
+static int quality_handle;
 static int confirm_mode;
 
 /* Gnome hig small and large space in pixels.  */
@@ -125,6 +129,19 @@ constrain_size (GtkWidget *win, GtkRequisition *req, gpointer data)
    toolkits and window managers, and is extremely unlikely to break
    anything, it seems reasonable to document it as standard.  */
 
+/* Record in the trace when the window is mapped.  */
+static gboolean
+map_event (GtkWidget *win, GdkEvent *event, gpointer data)
+{
+  (void)win;
+  (void)event;
+  (void)data;
+
+  pinentry_trace_mark ("window-mapped");
+  return FALSE;
+}
+
+
 static void
 make_transient (GtkWidget *win, GdkEvent *event, gpointer data)
 {
@@ -364,18 +381,50 @@ pinentry_utf8_validate (gchar *text)
 }
 
 
+/* Show the quality PERCENT in the quality bar.  If EMPTY is set the
+   passphrase is empty.  */
+static void
+set_quality_bar (int empty, int percent)
+{
+  char textbuf[50];
+  GdkColor color = { 0, 0, 0, 0};
+
+  if (empty)
+    {
+      strcpy(textbuf, QUALITYBAR_EMPTY_TEXT);
+      color.red = 0xffff;
+      percent = 0;
+    }
+  else if (percent < 0)
+    {
+      snprintf (textbuf, sizeof textbuf, "(%d%%)", -percent);
+      color.red = 0xffff;
+      percent = -percent;
+    }
+  else
+    {
+      snprintf (textbuf, sizeof textbuf, "%d%%", percent);
+      color.green = 0xffff;
+    }
+  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (qualitybar),
+                                 (double)percent/100.0);
+  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (qualitybar), textbuf);
+  gtk_widget_modify_bg (qualitybar, GTK_STATE_PRELIGHT, &color);
+}
+
+
 /* Handler called for "changed".   We use it to update the quality
    indicator.  */
 static void
 changed_text_handler (GtkWidget *widget)
 {
-  char textbuf[50];
   const char *s;
   int length;
-  int percent;
-  GdkColor color = { 0, 0, 0, 0};
+  int value;
+  int fd;
 
   got_input = TRUE;
+  pinentry_note_input (pinentry);
 
   if (pinentry->repeat_passphrase && repeat_entry)
     {
@@ -390,27 +439,24 @@ changed_text_handler (GtkWidget *widget)
   if (!s)
     s = "";
   length = strlen (s);
-  percent = length? pinentry_inq_quality (pinentry, s, length) : 0;
+  quality_handle = 0;
   if (!length)
-    {
-      strcpy(textbuf, QUALITYBAR_EMPTY_TEXT);
-      color.red = 0xffff;
-    }
-  else if (percent < 0)
-    {
-      snprintf (textbuf, sizeof textbuf, "(%d%%)", -percent);
-      color.red = 0xffff;
-      percent = -percent;
-    }
+    set_quality_bar (1, 0);
   else
     {
-      snprintf (textbuf, sizeof textbuf, "%d%%", percent);
-      color.green = 0xffff;
+      if (pinentry_quality_estimate (pinentry, s, length, &value))
+        set_quality_bar (0, value);
+
+      /* If possible, the result is shown by live_input_cb.  */
+      if (live_source)
+        quality_handle = pinentry_inq_quality_submit (pinentry,
+                                                      s, length, &fd);
+      if (quality_handle
+          && pinentry_inq_quality_collect (pinentry, &value) == quality_handle)
+        set_quality_bar (0, value);
+      else if (!quality_handle)
+        set_quality_bar (0, pinentry_inq_quality (pinentry, s, length));
     }
-  gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (qualitybar),
-                                 (double)percent/100.0);
-  gtk_progress_bar_set_text (GTK_PROGRESS_BAR (qualitybar), textbuf);
-  gtk_widget_modify_bg (qualitybar, GTK_STATE_PRELIGHT, &color);
 }
 
 
@@ -551,6 +597,87 @@ timeout_cb (gpointer data)
 }
 
 
+/* Create the label for the error message with TEXT below the
+   description.  */
+static void
+create_error_label (const gchar *text)
+{
+  GdkColor color = { 0, 0xffff, 0, 0 };
+
+  error_label = gtk_label_new (text);
+  gtk_misc_set_alignment (GTK_MISC (error_label), 0.0, 0.5);
+  gtk_label_set_line_wrap (GTK_LABEL (error_label), TRUE);
+  gtk_box_pack_start (GTK_BOX (message_box), error_label, TRUE, FALSE, 0);
+  gtk_box_reorder_child (GTK_BOX (message_box), error_label,
+                         error_label_position);
+  gtk_widget_modify_fg (error_label, GTK_STATE_NORMAL, &color);
+}
+
+
+/* Called when the client sent commands while the dialog is open.  */
+static gboolean
+live_input_cb (GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+  pinentry_t pe = (pinentry_t)data;
+  int flags;
+  int value;
+  gchar *msg;
+
+  (void)channel;
+  (void)condition;
+
+  flags = pinentry_process_input (pe);
+  if ((flags & PINENTRY_LIVE_CANCEL))
+    {
+      confirm_value = CONFIRM_CANCEL;
+      passphrase_ok = 0;
+      gtk_main_quit ();
+      live_source = 0;
+      return FALSE;
+    }
+  if ((flags & PINENTRY_LIVE_ERROR))
+    {
+      msg = pinentry_utf8_validate (pe->error);
+      if (error_label)
+        gtk_label_set_text (GTK_LABEL (error_label), msg ? msg : "");
+      else if (msg && *msg)
+        {
+          /* The dialog was created without an error line.  */
+          create_error_label (msg);
+          gtk_widget_show (error_label);
+        }
+      g_free (msg);
+    }
+  if ((flags & PINENTRY_LIVE_TIMEOUT))
+    {
+      if (timeout_source)
+        g_source_remove (timeout_source);
+      timeout_source = 0;
+      if (pe->timeout > 0)
+        timeout_source = g_timeout_add (pe->timeout*1000, timeout_cb, pe);
+    }
+  if ((flags & PINENTRY_LIVE_QUALITY) && qualitybar
+      && pinentry_inq_quality_collect (pe, &value) == quality_handle
+      && quality_handle)
+    set_quality_bar (0, value);
+
+  return TRUE;
+}
+
+
+/* Process the commands which were already buffered when the dialog
+   was created; the descriptor does not become readable for them.  */
+static gboolean
+live_input_idle_cb (gpointer data)
+{
+  guint source = live_source;
+
+  if (!live_input_cb (NULL, G_IO_IN, data) && source)
+    g_source_remove (source);
+  return FALSE;
+}
+
+
 static GtkWidget *
 create_show_hide_button (void)
 {
@@ -578,7 +705,9 @@ create_window (pinentry_t ctx)
   gchar *msg;
   char *p;
 
+  pinentry_trace_begin ("create-window");
   repeat_entry = NULL;
+  error_label = NULL;
 
   /* FIXME: check the grabbing code against the one we used with the
      old gpg-agent */
@@ -598,6 +727,8 @@ create_window (pinentry_t ctx)
 
   g_signal_connect (G_OBJECT (win),
 		    "realize", G_CALLBACK (make_transient), NULL);
+  g_signal_connect (G_OBJECT (win),
+		    "map-event", G_CALLBACK (map_event), NULL);
 
   if (!confirm_mode)
     {
@@ -655,24 +786,21 @@ create_window (pinentry_t ctx)
       gtk_label_set_line_wrap (GTK_LABEL (w), TRUE);
       gtk_box_pack_start (GTK_BOX (box), w, TRUE, FALSE, 0);
     }
+  message_box = box;
+  error_label_position = pinentry->description ? 1 : 0;
   if (!confirm_mode && (pinentry->error || pinentry->repeat_passphrase))
     {
       /* With the repeat passphrase option we need to create the label
          in any case so that it may later be updated by the error
          message.  */
-      GdkColor color = { 0, 0xffff, 0, 0 };
-
       if (pinentry->error)
-        msg = pinentry_utf8_validate (pinentry->error);
+        {
+          msg = pinentry_utf8_validate (pinentry->error);
+          create_error_label (msg);
+          g_free (msg);
+        }
       else
-        msg = "";
-      error_label = gtk_label_new (msg);
-      if (pinentry->error)
-        g_free (msg);
-      gtk_misc_set_alignment (GTK_MISC (error_label), 0.0, 0.5);
-      gtk_label_set_line_wrap (GTK_LABEL (error_label), TRUE);
-      gtk_box_pack_start (GTK_BOX (box), error_label, TRUE, FALSE, 0);
-      gtk_widget_modify_fg (error_label, GTK_STATE_NORMAL, &color);
+        create_error_label ("");
     }
 
   qualitybar = NULL;
@@ -906,6 +1034,19 @@ create_window (pinentry_t ctx)
   if (pinentry->timeout > 0)
     timeout_source = g_timeout_add (pinentry->timeout*1000, timeout_cb, pinentry);
 
+  if (pinentry_get_input_fd (pinentry) != -1)
+    {
+      GIOChannel *channel;
+
+      channel = g_io_channel_unix_new (pinentry_get_input_fd (pinentry));
+      live_source = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                    live_input_cb, pinentry);
+      g_io_channel_unref (channel);
+      if (pinentry_input_pending (pinentry))
+        g_idle_add (live_input_idle_cb, pinentry);
+    }
+
+  pinentry_trace_end ("create-window");
   return win;
 }
 
@@ -933,6 +1074,11 @@ gtk_cmd_handler (pinentry_t pe)
       g_source_remove (timeout_source);
       timeout_source = 0;
     }
+  if (live_source)
+    {
+      g_source_remove (live_source);
+      live_source = 0;
+    }
 
   if (confirm_value == CONFIRM_CANCEL || grab_failed)
     pe->canceled = 1;
@@ -957,7 +1103,12 @@ int
 main (int argc, char *argv[])
 {
   pinentry_init (PGMNAME);
+  pinentry_set_features (PINENTRY_FEATURE_QUALITY_BAR
+                         | PINENTRY_FEATURE_EXTERNAL_CACHE
+                         | PINENTRY_FEATURE_ASYNC_QUALITY
+                         | PINENTRY_FEATURE_LIVE_UPDATES);
 
+  pinentry_trace_begin ("gtk-init");
 #ifdef FALLBACK_CURSES
   if (pinentry_have_display (argc, argv))
     {
@@ -965,16 +1116,19 @@ main (int argc, char *argv[])
         {
           pinentry_cmd_handler = curses_cmd_handler;
           pinentry_set_flavor_flag ("curses");
+          pinentry_set_features (PINENTRY_CURSES_FEATURES);
         }
     }
   else
     {
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
+      pinentry_set_features (PINENTRY_CURSES_FEATURES);
     }
 #else
   gtk_init (&argc, &argv);
 #endif
+  pinentry_trace_end ("gtk-init");
 
   pinentry_parse_opts (argc, argv);
 
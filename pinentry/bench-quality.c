@@ -0,0 +1,308 @@
+/* bench-quality.c - Benchmark for the asynchronous quality inquiry.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program runs a GETPIN against a fake gpg-agent over a
+   socketpair.  The agent answers each INQUIRE QUALITY only after a
+   delay.  A fake dialog types a key at a fixed interval, submits a
+   quality inquiry for each one as the Qt frontends do and processes
+   the responses in between.  It checks that no key has to wait for
+   the agent, that only the result for the newest passphrase is
+   reported and that this result arrives at the end.  It reports the
+   worst time spent handling a key or a response.  It is not built by
+   default; use "make bench-quality" to build it.  Usage:
+
+     bench-quality [DELAY-MS [KEYS [INTERVAL-MS]]]
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "pinentry.h"
+#include "stats.h"
+
+/* The most keys typed; the agent reports the length of the
+   passphrase as its quality, which must not exceed 100.  */
+#define MAX_KEYS 100
+
+static int delay_ms = 50;
+static int n_keys = 40;
+static int interval_ms = 10;
+
+static int errors;
+static uint64_t worst_usec;
+static int n_submitted;
+static int n_results;
+static int last_result;  /* The request of the last result reported.  */
+
+#define fail(...) do { fprintf (stderr, "bench-quality: " __VA_ARGS__); \
+                       errors++; } while (0)
+
+
+/* Act as gpg-agent on FD: ask for a PIN with a quality bar and answer
+   each quality inquiry with the length of the passphrase after
+   DELAY_MS.  Returns the exit code for the child process.  */
+static int
+run_agent (int fd)
+{
+  FILE *in = fdopen (fd, "r");
+  FILE *out = fdopen (dup (fd), "w");
+  char line[1100];
+  char pin[MAX_KEYS + 1] = "";
+  int n_inquiries = 0;
+  int okay = 0;
+  size_t n;
+
+  if (!in || !out)
+    return 2;
+
+  /* The greeting and the answers to the setup commands.  */
+  if (!fgets (line, sizeof line, in) || strncmp (line, "OK", 2))
+    return 2;
+  fputs ("OPTION quality-mode=agent\n", out);
+  fflush (out);
+  if (!fgets (line, sizeof line, in) || strncmp (line, "OK", 2))
+    return 2;
+  fputs ("SETQUALITYBAR\n", out);
+  fflush (out);
+  if (!fgets (line, sizeof line, in) || strncmp (line, "OK", 2))
+    return 2;
+
+  fputs ("GETPIN\n", out);
+  fflush (out);
+  while (fgets (line, sizeof line, in))
+    {
+      line[strcspn (line, "\n")] = 0;
+      if (!strncmp (line, "INQUIRE QUALITY ", 16))
+        {
+          n_inquiries++;
+          usleep (delay_ms * 1000);
+          fprintf (out, "D %d\nEND\n", (int)strlen (line + 16));
+          fflush (out);
+        }
+      else if (!strncmp (line, "D ", 2))
+        {
+          n = strlen (line + 2);
+          if (n > MAX_KEYS)
+            n = MAX_KEYS;
+          memcpy (pin, line + 2, n);
+          pin[n] = 0;
+        }
+      else if (!strncmp (line, "OK", 2))
+        {
+          okay = 1;
+          break;
+        }
+      else if (!strncmp (line, "ERR", 3))
+        break;
+    }
+
+  printf ("%d keys, %d inquiries sent to the agent\n", n_keys, n_inquiries);
+  fflush (stdout);
+  /* Wait for the answer so that pinentry does not write to a closed
+     socket.  */
+  fputs ("BYE\n", out);
+  fflush (out);
+  fgets (line, sizeof line, in);
+  if (!okay || (int)strlen (pin) != n_keys)
+    {
+      fprintf (stderr, "bench-quality: agent got no or a wrong PIN\n");
+      return 1;
+    }
+  return 0;
+}
+
+
+/* Record the time spent since START.  */
+static void
+record (uint64_t start)
+{
+  uint64_t usec = stats_now () - start;
+
+  if (usec > worst_usec)
+    worst_usec = usec;
+}
+
+
+/* Run the event loop of the fake dialog on PE for MS milliseconds or,
+   if UNTIL_RESULT is set, until the result for the request LAST has
+   arrived.  A result must be for LAST and the passphrase length
+   LENGTH.  Returns false if the dialog was canceled.  */
+static int
+run_events (pinentry_t pe, int fd, int ms, int last, int length,
+            int until_result)
+{
+  uint64_t deadline = stats_now () + (uint64_t)ms * 1000;
+  struct pollfd pfd;
+  uint64_t start;
+  int64_t left;
+  int flags, handle, value;
+
+  for (;;)
+    {
+      if (until_result && last_result == last)
+        return 1;
+      left = (int64_t)(deadline - stats_now ());
+      if (left <= 0)
+        {
+          if (until_result)
+            fail ("no result for the last passphrase\n");
+          return 1;
+        }
+      /* Commands may already be buffered, in which case FD does not
+         become readable.  */
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      if (!pinentry_input_pending (pe)
+          && poll (&pfd, 1, (int)((left + 999) / 1000)) <= 0)
+        continue;
+
+      start = stats_now ();
+      flags = pinentry_process_input (pe);
+      if ((flags & PINENTRY_LIVE_QUALITY)
+          && (handle = pinentry_inq_quality_collect (pe, &value)))
+        {
+          n_results++;
+          last_result = handle;
+          if (handle != last)
+            fail ("result of superseded request %d reported\n", handle);
+          else if (value != length)
+            fail ("result %d for a passphrase of length %d\n",
+                  value, length);
+        }
+      record (start);
+      if ((flags & PINENTRY_LIVE_CANCEL))
+        {
+          fail ("dialog canceled\n");
+          return 0;
+        }
+    }
+}
+
+
+/* The command handler standing in for the dialog of a frontend.  */
+static int
+fake_dialog (pinentry_t pe)
+{
+  char text[MAX_KEYS + 1];
+  uint64_t start;
+  int i, fd = -1, last = 0;
+
+  for (i = 0; i < n_keys; i++)
+    {
+      text[i] = 'a' + i % 26;
+      text[i + 1] = 0;
+
+      start = stats_now ();
+      pinentry_note_input (pe);
+      last = pinentry_inq_quality_submit (pe, text, i + 1, &fd);
+      record (start);
+      if (!last)
+        {
+          fail ("no asynchronous inquiry possible\n");
+          return -1;
+        }
+      n_submitted++;
+
+      if (!run_events (pe, fd, interval_ms, last, i + 1, 0))
+        return -1;
+    }
+
+  /* Wait for the result for the complete passphrase.  The agent may
+     still be busy with one older request.  */
+  if (!run_events (pe, fd, 2 * delay_ms + 1000, last, n_keys, 1))
+    return -1;
+
+  pinentry_setbufferlen (pe, n_keys + 1);
+  if (!pe->pin)
+    return -1;
+  memcpy (pe->pin, text, n_keys + 1);
+  return n_keys;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = fake_dialog;
+
+
+int
+main (int argc, char **argv)
+{
+  int sv[2];
+  int status;
+  pid_t pid;
+
+  if (argc > 1)
+    delay_ms = atoi (argv[1]);
+  if (argc > 2)
+    n_keys = atoi (argv[2]);
+  if (argc > 3)
+    interval_ms = atoi (argv[3]);
+  if (delay_ms < 0 || n_keys < 1 || n_keys > MAX_KEYS || interval_ms < 0)
+    {
+      fprintf (stderr, "usage: bench-quality [DELAY-MS [KEYS [INTERVAL-MS]]]\n");
+      return 2;
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+      fprintf (stderr, "bench-quality: socketpair failed: %s\n",
+               strerror (errno));
+      return 2;
+    }
+  fflush (stdout);
+  pid = fork ();
+  if (pid == -1)
+    {
+      fprintf (stderr, "bench-quality: fork failed: %s\n", strerror (errno));
+      return 2;
+    }
+  if (!pid)
+    {
+      close (sv[0]);
+      _exit (run_agent (sv[1]));
+    }
+  close (sv[1]);
+
+  pinentry_init ("bench-quality");
+  if (pinentry_loop2 (sv[0], sv[0]))
+    fail ("serving the agent failed\n");
+  close (sv[0]);
+  if (waitpid (pid, &status, 0) == -1
+      || !WIFEXITED (status) || WEXITSTATUS (status))
+    fail ("the agent failed\n");
+
+  printf ("%d quality requests, %d results reported\n",
+          n_submitted, n_results);
+  printf ("agent delay %d ms: worst time for a key or response %.3f ms\n",
+          delay_ms, worst_usec / 1000.0);
+  /* A key must never wait for the agent.  */
+  if (delay_ms && worst_usec >= (uint64_t)delay_ms * 1000 / 2)
+    fail ("handling a key or response took too long\n");
+
+  return errors ? 1 : 0;
+}
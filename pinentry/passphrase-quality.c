@@ -0,0 +1,289 @@
+/* passphrase-quality.c - Local passphrase quality estimation.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This is a small estimator in the spirit of zxcvbn.  It credits each
+   character with the entropy of the character classes used in the
+   passphrase, but only a single bit for characters continuing a
+   repetition, a sequence or a run of adjacent keys, and a fixed
+   amount for a whole word from a list of common passwords.  The
+   passphrase is only read; no copy of it is ever made.  The result
+   is only meant to draw the quality bar.  The caller (gpg-agent)
+   remains in charge of deciding whether a passphrase is
+   acceptable.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "passphrase-quality.h"
+
+/* All entropy values are in units of 1/16 bit.  */
+#define BITS(n) ((n) * 16)
+
+/* The entropy for which 100 percent are shown.  */
+#define FULL_QUALITY_BITS BITS (80)
+
+/* The entropy credited for a word from COMMON_WORDS.  */
+#define COMMON_WORD_BITS BITS (12)
+
+/* The entropy credited for a character continuing a pattern.  */
+#define PATTERN_BITS BITS (1)
+
+/* The shortest word from COMMON_WORDS we try to match.  */
+#define MIN_WORD_LEN 4
+
+/* Passwords and words which are so common that they do not add much
+   to the strength of a passphrase.  Matching is case-insensitive and
+   undoes the usual digit and symbol substitutions.  */
+static const char *const common_words[] =
+  {
+    "password", "passwort", "qwerty", "qwertz", "azerty", "letmein",
+    "welcome", "admin", "login", "master", "secret", "dragon",
+    "monkey", "shadow", "sunshine", "princess", "football", "baseball",
+    "iloveyou", "trustno", "superman", "batman", "starwars", "whatever",
+    "freedom", "hello", "charlie", "michael", "jordan", "summer",
+    "winter", "spring", "autumn", "abcdef", "changeme", "default",
+    "pinentry", "gnupg", "test", "love", "pass", "root", "user",
+    "guest"
+  };
+
+/* Rows of keys as they are adjacent on common keyboards.  */
+static const char *const keyboard_rows[] =
+  {
+    "`1234567890-=", "qwertyuiop[]", "asdfghjkl;'", "zxcvbnm,./",
+    "qwertzuiop", "asdfghjkl", "yxcvbnm", "azertyuiop", "qsdfghjklm",
+    "wxcvbn"
+  };
+
+/* The character classes.  */
+#define CLASS_LOWER  1
+#define CLASS_UPPER  2
+#define CLASS_DIGIT  4
+#define CLASS_SYMBOL 8
+#define CLASS_OTHER  16
+
+
+static int
+char_class (unsigned char c)
+{
+  if (c >= 'a' && c <= 'z')
+    return CLASS_LOWER;
+  if (c >= 'A' && c <= 'Z')
+    return CLASS_UPPER;
+  if (c >= '0' && c <= '9')
+    return CLASS_DIGIT;
+  if (c < 0x80)
+    return CLASS_SYMBOL;
+  return CLASS_OTHER;
+}
+
+
+/* Return the lowercase version of the ASCII character C.  We do not
+   use tolower so that the result does not depend on the locale.  */
+static unsigned char
+ascii_lower (unsigned char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+
+/* Return log2 (N) in units of 1/16 bit.  */
+static unsigned int
+log2_bits (unsigned int n)
+{
+  unsigned int ipart = 0;
+  unsigned int fpart = 0;
+  uint64_t x;
+  int i;
+
+  if (n < 2)
+    return 0;
+
+  while (n >> (ipart + 1))
+    ipart++;
+
+  /* X is N / 2^IPART as a 16.16 fixed point value in [1,2).  Each
+     squaring yields one more bit of the fraction.  The square needs
+     up to 34 bits.  */
+  x = ((uint64_t)n << 16) >> ipart;
+  for (i = 3; i >= 0; i--)
+    {
+      x = (x * x) >> 16;
+      if (x >= ((uint64_t)2 << 16))
+        {
+          x >>= 1;
+          fpart |= 1 << i;
+        }
+    }
+
+  return BITS (ipart) + fpart;
+}
+
+
+/* Return true if the passphrase character C matches the character W
+   of a common word.  */
+static int
+word_char_match (unsigned char c, char w)
+{
+  c = ascii_lower (c);
+  if (c == w)
+    return 1;
+
+  switch (c)
+    {
+    case '0': return w == 'o';
+    case '1': return w == 'i' || w == 'l';
+    case '!': return w == 'i';
+    case '3': return w == 'e';
+    case '4':
+    case '@': return w == 'a';
+    case '5':
+    case '$': return w == 's';
+    case '7':
+    case '+': return w == 't';
+    default:  return 0;
+    }
+}
+
+
+/* Return the length of the longest word from COMMON_WORDS at the
+   start of S of LENGTH or 0 if there is none.  */
+static size_t
+match_common_word (const unsigned char *s, size_t length)
+{
+  size_t best = 0;
+  size_t i, n;
+  const char *w;
+
+  for (i = 0; i < sizeof common_words / sizeof *common_words; i++)
+    {
+      w = common_words[i];
+      for (n = 0; w[n] && n < length && word_char_match (s[n], w[n]); n++)
+        ;
+      if (!w[n] && n >= MIN_WORD_LEN && n > best)
+        best = n;
+    }
+
+  return best;
+}
+
+
+/* Return true if A and B are adjacent keys in one of KEYBOARD_ROWS.  */
+static int
+keys_adjacent (unsigned char a, unsigned char b)
+{
+  const char *row, *p;
+  size_t i;
+
+  a = ascii_lower (a);
+  b = ascii_lower (b);
+  if (!a || !b || a >= 0x80 || b >= 0x80)
+    return 0;
+
+  for (i = 0; i < sizeof keyboard_rows / sizeof *keyboard_rows; i++)
+    {
+      row = keyboard_rows[i];
+      p = strchr (row, a);
+      if (p && ((p > row && p[-1] == b) || p[1] == b))
+        return 1;
+    }
+
+  return 0;
+}
+
+
+/* Return true if the character C continues a pattern after the
+   character PREV.  */
+static int
+continues_pattern (unsigned char prev, unsigned char c)
+{
+  if (c == prev)
+    return 1;  /* Repetition.  */
+  if (c < 0x80 && prev < 0x80
+      && char_class (c) == char_class (prev)
+      && (c == prev + 1 || c + 1 == prev))
+    return 1;  /* Sequence like "abc" or "987".  */
+  return keys_adjacent (prev, c);
+}
+
+
+/* Estimate the quality of PASSPHRASE of LENGTH (which is UTF-8
+   encoded and need not be Nul terminated).  Returns a value between 0
+   and 100.  */
+int
+passphrase_quality_estimate (const char *passphrase, size_t length)
+{
+  const unsigned char *s = (const unsigned char *)passphrase;
+  unsigned int classes = 0;
+  unsigned int pool = 0;
+  unsigned int char_bits;
+  unsigned long bits = 0;
+  size_t i, n;
+  int prev = -1;
+
+  for (i = 0; i < length; i++)
+    classes |= char_class (s[i]);
+
+  if ((classes & CLASS_LOWER))
+    pool += 26;
+  if ((classes & CLASS_UPPER))
+    pool += 26;
+  if ((classes & CLASS_DIGIT))
+    pool += 10;
+  if ((classes & CLASS_SYMBOL))
+    pool += 33;
+  if ((classes & CLASS_OTHER))
+    pool += 100;
+  char_bits = log2_bits (pool);
+
+  for (i = 0; i < length; )
+    {
+      if ((s[i] & 0xc0) == 0x80)
+        {
+          /* A UTF-8 continuation byte; the character has already
+             been accounted for by its first byte.  */
+          i++;
+          continue;
+        }
+
+      n = match_common_word (s + i, length - i);
+      if (n)
+        {
+          bits += COMMON_WORD_BITS;
+          prev = -1;
+          i += n;
+          continue;
+        }
+
+      if (prev != -1 && continues_pattern (prev, s[i]))
+        bits += PATTERN_BITS;
+      else
+        bits += char_bits;
+      prev = s[i];
+      i++;
+    }
+
+  if (bits >= FULL_QUALITY_BITS)
+    return 100;
+  return (int)(bits * 100 / FULL_QUALITY_BITS);
+}
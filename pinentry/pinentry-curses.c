@@ -1155,6 +1155,31 @@ dialog_release (dialog_t diag)
     free (diag->error);
 }
 
+/* Draw the quality bar of DIAG for the quality value N.  */
+static void
+dialog_show_quality (dialog_t diag, int n)
+{
+  char buf[16], *p = buf;
+  int r;
+
+  if (n < 0)
+    return;
+
+  move(diag->quality_y, diag->quality_x);
+  hline(' ', diag->quality_size);
+  r = n*diag->quality_size/100;
+  attroff (COLOR_PAIR (1) | (diag->pinentry->color_fg_bright ? A_BOLD : 0));
+  attron (COLOR_PAIR (4) | (diag->pinentry->color_qualitybar_bright ? A_BOLD : 0));
+  hline(ACS_BLOCK, r);
+  attroff (COLOR_PAIR (4) | (diag->pinentry->color_fg_bright ? A_BOLD : 0));
+  attron (COLOR_PAIR (1) | (diag->pinentry->color_qualitybar_bright ? A_BOLD : 0));
+  snprintf (buf, sizeof(buf), "%i%%", n);
+  move(diag->quality_y, diag->quality_x+((diag->quality_size/2)-(strlen(buf)/2)));
+  for (; p && *p; p++)
+    addch(*p);
+}
+
+
 /* XXX Assume that field width is at least > 5.  */
 static void
 dialog_input (dialog_t diag, int alt, int chr)
@@ -1315,6 +1340,7 @@ dialog_input (dialog_t diag, int alt, int chr)
     }
 
   diag->got_input = 1;
+  pinentry_note_input (diag->pinentry);
 
   if (!diag->no_echo)
     {
@@ -1338,31 +1364,61 @@ dialog_input (dialog_t diag, int alt, int chr)
 
   if (diag->pinentry->repeat_passphrase && diag->pos == DIALOG_POS_PIN)
     {
-      int n = pinentry_inq_quality(diag->pinentry, pin, *pin_len);
+      int value;
+#ifndef HAVE_DOSISH_SYSTEM
+      int fd;
+#endif
 
-      if (n >= 0)
+      if (pinentry_quality_estimate (diag->pinentry, pin, *pin_len, &value))
+        dialog_show_quality (diag, value);
+#ifndef HAVE_DOSISH_SYSTEM
+      /* The result is shown by check_live_input when it arrives.  */
+      if (pinentry_inq_quality_submit (diag->pinentry, pin, *pin_len, &fd))
         {
-          char buf[16], *p = buf;
-          int r;
-
-          move(diag->quality_y, diag->quality_x);
-          hline(' ', diag->quality_size);
-          r = n*diag->quality_size/100;
-          attroff (COLOR_PAIR (1) | (diag->pinentry->color_fg_bright ? A_BOLD : 0));
-          attron (COLOR_PAIR (4) | (diag->pinentry->color_qualitybar_bright ? A_BOLD : 0));
-          hline(ACS_BLOCK, r);
-          attroff (COLOR_PAIR (4) | (diag->pinentry->color_fg_bright ? A_BOLD : 0));
-          attron (COLOR_PAIR (1) | (diag->pinentry->color_qualitybar_bright ? A_BOLD : 0));
-          if (n >= 0)
-            {
-              snprintf (buf, sizeof(buf), "%i%%", n);
-              move(diag->quality_y, diag->quality_x+((diag->quality_size/2)-(strlen(buf)/2)));
-              for (; p && *p; p++)
-                addch(*p);
-            }
+          if (pinentry_inq_quality_collect (diag->pinentry, &value))
+            dialog_show_quality (diag, value);
+          return;
         }
+#endif
+      dialog_show_quality (diag,
+                           pinentry_inq_quality (diag->pinentry,
+                                                 pin, *pin_len));
+    }
+}
+
+#ifndef HAVE_DOSISH_SYSTEM
+/* Process the commands and quality results the client sent while the
+   dialog DIAG is open.  Returns true if the dialog shall be canceled.
+   Changes to the error text are ignored because the layout of the
+   dialog is fixed.  */
+static int
+check_live_input (dialog_t diag)
+{
+  pinentry_t pinentry = diag->pinentry;
+  int flags;
+  int value;
+  int y, x;
+
+  if (!pinentry_input_pending (pinentry))
+    return 0;
+
+  flags = pinentry_process_input (pinentry);
+  if ((flags & PINENTRY_LIVE_TIMEOUT))
+    {
+      /* Restart the timer with the new timeout.  */
+      timed_out = 0;
+      alarm (pinentry->timeout > 0 ? pinentry->timeout : 0);
+    }
+  if ((flags & PINENTRY_LIVE_QUALITY)
+      && pinentry_inq_quality_collect (pinentry, &value))
+    {
+      getyx (stdscr, y, x);
+      dialog_show_quality (diag, value);
+      move (y, x);
     }
+  return !!(flags & PINENTRY_LIVE_CANCEL);
 }
+#endif
 
 static int
 dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
@@ -1514,9 +1570,11 @@ dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
   refresh ();
 
   /* Create the dialog.  */
+  pinentry_trace_begin ("create-dialog");
   if (dialog_create (pinentry, &diag))
     {
       /* Note: pinentry->specific_err has already been set.  */
+      pinentry_trace_end ("create-dialog");
       endwin ();
       if (screen)
         delscreen (screen);
@@ -1536,6 +1594,7 @@ dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
       return -2;
     }
   dialog_switch_pos (&diag, confirm_mode? DIALOG_POS_OK : DIALOG_POS_PIN);
+  pinentry_trace_end ("create-dialog");
 
 #ifndef HAVE_DOSISH_SYSTEM
   wtimeout (stdscr, 70);
@@ -1565,6 +1624,11 @@ dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
 	{
 	case ERR:
 #ifndef HAVE_DOSISH_SYSTEM
+	  if (check_live_input (&diag))
+	    {
+	      done = -2;
+	      break;
+	    }
 	  continue;
 #else
           done = -2;
@@ -1812,11 +1876,11 @@ curses_cmd_handler (pinentry_t pinentry)
 
   timed_out = 0;
 
+  /* The handler is also needed if the client sets a timeout while
+     the dialog is open.  */
+  sigaction (SIGALRM, &sa, NULL);
   if (pinentry->timeout)
-    {
-      sigaction (SIGALRM, &sa, NULL);
-      alarm (pinentry->timeout);
-    }
+    alarm (pinentry->timeout);
 #endif
 
   rc = dialog_run (pinentry, pinentry->ttyname, pinentry->ttytype_l);
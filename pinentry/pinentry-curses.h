@@ -26,6 +26,11 @@
 extern "C" {
 #endif
 
+/* The features of curses_cmd_handler.  live-updates is not among
+   them because a changed error text is not shown.  */
+#define PINENTRY_CURSES_FEATURES (PINENTRY_FEATURE_QUALITY_BAR      \
+                                  | PINENTRY_FEATURE_ASYNC_QUALITY)
+
 int curses_cmd_handler (pinentry_t pinentry);
 
 #ifdef __cplusplus
@@ -31,9 +31,14 @@
 #include <assert.h>
 #ifndef HAVE_W32_SYSTEM
 # include <sys/utsname.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <signal.h>
+# include <poll.h>
 #endif
 #include <locale.h>
 #include <limits.h>
+#include <stddef.h>
 
 #include <assuan.h>
 
@@ -41,6 +46,10 @@
 #include "argparse.h"
 #include "pinentry.h"
 #include "password-cache.h"
+#include "passphrase-quality.h"
+#include "quality-cache.h"
+#include "stats.h"
+#include "trace.h"
 
 #ifdef INSIDE_EMACS
 # include "pinentry-emacs.h"
@@ -49,15 +58,93 @@
 # include "pinentry-curses.h"
 #endif
 
+#define DIM(v) (sizeof (v) / sizeof ((v)[0]))
+
+/* The quality mode used if not changed by the client.  */
+#ifndef DEFAULT_QUALITY_MODE
+# define DEFAULT_QUALITY_MODE "agent"
+#endif
+
 
 /* Keep the name of our program here. */
 static char this_pgmname[50];
 
-struct pinentry pinentry;
+/* The defaults and the options given on the command line.  Each new
+   session starts with a copy of them.  */
+static struct pinentry pinentry_defaults;
+
+/* The state of one Assuan session.  A session object is created for
+   each connection and attached to its assuan context so that the
+   command handlers do not depend on any global state.  */
+struct session_s
+{
+  /* The request as seen by the frontends.  */
+  struct pinentry pinentry;
+
+  /* The command handler to run the dialogs of this session.  This is
+     initialized from pinentry_cmd_handler.  */
+  pinentry_cmd_handler_t cmd_handler;
+
+  /* The PINENTRY_LIVE_* flags of the commands which arrived while a
+     dialog was open but have not yet been reported to the frontend
+     by pinentry_process_input.  */
+  int live_flags;
+
+  /* The time the current dialog was started and whether the user
+     already provided input to it.  */
+  uint64_t dialog_start;
+  int got_input;
+
+  /* The state of the asynchronous quality inquiry.  Only one inquiry
+     may be outstanding at a time; the newest passphrase submitted
+     meanwhile is kept in PENDING and sent when the response to the
+     outstanding inquiry has arrived.  */
+  struct
+  {
+    int last;            /* Handle of the newest submitted request.  */
+    int sent;            /* Handle of the outstanding inquiry or 0.  */
+    int got_value;       /* A data line for SENT has been received.  */
+    int value;           /* The value from that data line.  */
+    int pending;         /* Handle of PENDING_LINE or 0.  */
+    char *pending_line;  /* The secmem allocated INQUIRE line.  */
+    int result;          /* Handle of the uncollected result or 0.  */
+    int result_value;    /* The value of that result.  */
+    uint64_t sent_hash;  /* Cache hash of the outstanding inquiry.  */
+    uint64_t sent_time;  /* The time the inquiry was sent.  */
+    uint64_t pending_hash;  /* Cache hash of PENDING_LINE.  */
+
+    /* The results received during the current GETPIN or NULL.  */
+    quality_cache_t cache;
+  } quality;
+};
+typedef struct session_s *session_t;
 
+/* The malloced string options of struct pinentry which are copied
+   from PINENTRY_DEFAULTS to a new session.  */
+static const size_t default_string_options[] =
+  {
+    offsetof (struct pinentry, display),
+    offsetof (struct pinentry, ttyname),
+    offsetof (struct pinentry, ttytype_l),
+    offsetof (struct pinentry, ttyalert),
+    offsetof (struct pinentry, lc_ctype),
+    offsetof (struct pinentry, lc_messages)
+  };
 
+/* The flavor flag describes the toolkit initialized by the frontend
+   and is thus the same for all sessions.  */
 static const char *flavor_flag;
 
+/* The features of the frontend.  See pinentry_set_features.  */
+static unsigned int frontend_features;
+
+/* The names of the PINENTRY_FEATURE_ values for GETINFO features.  */
+static const char *const feature_names[] =
+  {
+    "quality-bar", "genpin", "formatted-passphrase", "constraints",
+    "external-cache", "async-quality", "live-updates"
+  };
+
 /* Because gtk_init removes the --display arg from the command lines
  * and our command line parser is called after gtk_init (so that it
  * does not see gtk specific options) we don't have a way to get hold
@@ -66,181 +153,370 @@ static const char *flavor_flag;
  * parser.  */
 static char *remember_display;
 
+/* Set by the --listen option.  If LISTEN_MODE is true pinentry_loop
+ * does not serve stdin/stdout but accepts connections on a Unix
+ * domain socket.  LISTEN_SOCKET_NAME is the malloced name of that
+ * socket or NULL to use the default.  */
+static int listen_mode;
+static char *listen_socket_name;
+
+/* True if the trace file has been given by --trace or PINENTRY_TRACE.
+ * OPTION trace does then not change it.  */
+static int trace_file_set;
+
+/* Parse the quality mode STRING and store it at R_MODE.  Returns
+   false if STRING is not a valid mode.  */
+static int
+parse_quality_mode (const char *string, pinentry_quality_mode_t *r_mode)
+{
+  if (!strcmp (string, "agent"))
+    *r_mode = PINENTRY_QUALITY_AGENT;
+  else if (!strcmp (string, "local"))
+    *r_mode = PINENTRY_QUALITY_LOCAL;
+  else if (!strcmp (string, "hybrid"))
+    *r_mode = PINENTRY_QUALITY_HYBRID;
+  else
+    return 0;
+  return 1;
+}
+
+
 static void
-pinentry_reset (int use_defaults)
+pinentry_reset (pinentry_t pe, int use_defaults)
 {
   /* GPG Agent sets these options once when it starts the pinentry.
      Don't reset them.  */
-  int grab = pinentry.grab;
-  char *ttyname = pinentry.ttyname;
-  char *ttytype = pinentry.ttytype_l;
-  char *ttyalert = pinentry.ttyalert;
-  char *lc_ctype = pinentry.lc_ctype;
-  char *lc_messages = pinentry.lc_messages;
-  int allow_external_password_cache = pinentry.allow_external_password_cache;
-  char *default_ok = pinentry.default_ok;
-  char *default_cancel = pinentry.default_cancel;
-  char *default_prompt = pinentry.default_prompt;
-  char *default_pwmngr = pinentry.default_pwmngr;
-  char *default_cf_visi = pinentry.default_cf_visi;
-  char *default_tt_visi = pinentry.default_tt_visi;
-  char *default_tt_hide = pinentry.default_tt_hide;
-  char *default_capshint = pinentry.default_capshint;
-  char *touch_file = pinentry.touch_file;
-  unsigned long owner_pid = pinentry.owner_pid;
-  int owner_uid = pinentry.owner_uid;
-  char *owner_host = pinentry.owner_host;
-  int constraints_enforce = pinentry.constraints_enforce;
-  char *constraints_hint_short = pinentry.constraints_hint_short;
-  char *constraints_hint_long = pinentry.constraints_hint_long;
-  char *constraints_error_title = pinentry.constraints_error_title;
+  int grab = pe->grab;
+  char *ttyname = pe->ttyname;
+  char *ttytype = pe->ttytype_l;
+  char *ttyalert = pe->ttyalert;
+  char *lc_ctype = pe->lc_ctype;
+  char *lc_messages = pe->lc_messages;
+  int allow_external_password_cache = pe->allow_external_password_cache;
+  char *default_ok = pe->default_ok;
+  char *default_cancel = pe->default_cancel;
+  char *default_prompt = pe->default_prompt;
+  char *default_pwmngr = pe->default_pwmngr;
+  char *default_cf_visi = pe->default_cf_visi;
+  char *default_tt_visi = pe->default_tt_visi;
+  char *default_tt_hide = pe->default_tt_hide;
+  char *default_capshint = pe->default_capshint;
+  char *touch_file = pe->touch_file;
+  unsigned long owner_pid = pe->owner_pid;
+  int owner_uid = pe->owner_uid;
+  char *owner_host = pe->owner_host;
+  int constraints_enforce = pe->constraints_enforce;
+  pinentry_quality_mode_t quality_mode = pe->quality_mode;
+  char *constraints_hint_short = pe->constraints_hint_short;
+  char *constraints_hint_long = pe->constraints_hint_long;
+  char *constraints_error_title = pe->constraints_error_title;
 
   /* These options are set from the command line.  Don't reset
      them.  */
-  int debug = pinentry.debug;
-  char *display = pinentry.display;
-  int parent_wid = pinentry.parent_wid;
+  int debug = pe->debug;
+  char *display = pe->display;
+  int parent_wid = pe->parent_wid;
 
-  pinentry_color_t color_fg = pinentry.color_fg;
-  int color_fg_bright = pinentry.color_fg_bright;
-  pinentry_color_t color_bg = pinentry.color_bg;
-  pinentry_color_t color_so = pinentry.color_so;
-  int color_so_bright = pinentry.color_so_bright;
-  pinentry_color_t color_ok = pinentry.color_ok;
-  int color_ok_bright = pinentry.color_ok_bright;
-  pinentry_color_t color_qualitybar = pinentry.color_qualitybar;
-  int color_qualitybar_bright = pinentry.color_qualitybar_bright;
+  pinentry_color_t color_fg = pe->color_fg;
+  int color_fg_bright = pe->color_fg_bright;
+  pinentry_color_t color_bg = pe->color_bg;
+  pinentry_color_t color_so = pe->color_so;
+  int color_so_bright = pe->color_so_bright;
+  pinentry_color_t color_ok = pe->color_ok;
+  int color_ok_bright = pe->color_ok_bright;
+  pinentry_color_t color_qualitybar = pe->color_qualitybar;
+  int color_qualitybar_bright = pe->color_qualitybar_bright;
 
-  int timeout = pinentry.timeout;
+  int timeout = pe->timeout;
 
-  char *invisible_char = pinentry.invisible_char;
+  char *invisible_char = pe->invisible_char;
 
 
   /* Free any allocated memory.  */
   if (use_defaults)
     {
-      free (pinentry.ttyname);
-      free (pinentry.ttytype_l);
-      free (pinentry.ttyalert);
-      free (pinentry.lc_ctype);
-      free (pinentry.lc_messages);
-      free (pinentry.default_ok);
-      free (pinentry.default_cancel);
-      free (pinentry.default_prompt);
-      free (pinentry.default_pwmngr);
-      free (pinentry.default_cf_visi);
-      free (pinentry.default_tt_visi);
-      free (pinentry.default_tt_hide);
-      free (pinentry.default_capshint);
-      free (pinentry.touch_file);
-      free (pinentry.owner_host);
-      free (pinentry.display);
-      free (pinentry.constraints_hint_short);
-      free (pinentry.constraints_hint_long);
-      free (pinentry.constraints_error_title);
-    }
-
-  free (pinentry.title);
-  free (pinentry.description);
-  free (pinentry.error);
-  free (pinentry.prompt);
-  free (pinentry.ok);
-  free (pinentry.notok);
-  free (pinentry.cancel);
-  secmem_free (pinentry.pin);
-  free (pinentry.repeat_passphrase);
-  free (pinentry.repeat_error_string);
-  free (pinentry.quality_bar);
-  free (pinentry.quality_bar_tt);
-  free (pinentry.formatted_passphrase_hint);
-  free (pinentry.keyinfo);
-  free (pinentry.specific_err_info);
+      free (pe->ttyname);
+      free (pe->ttytype_l);
+      free (pe->ttyalert);
+      free (pe->lc_ctype);
+      free (pe->lc_messages);
+      free (pe->default_ok);
+      free (pe->default_cancel);
+      free (pe->default_prompt);
+      free (pe->default_pwmngr);
+      free (pe->default_cf_visi);
+      free (pe->default_tt_visi);
+      free (pe->default_tt_hide);
+      free (pe->default_capshint);
+      free (pe->touch_file);
+      free (pe->owner_host);
+      free (pe->display);
+      free (pe->constraints_hint_short);
+      free (pe->constraints_hint_long);
+      free (pe->constraints_error_title);
+    }
+
+  free (pe->title);
+  free (pe->description);
+  free (pe->error);
+  free (pe->prompt);
+  free (pe->ok);
+  free (pe->notok);
+  free (pe->cancel);
+  secmem_free (pe->pin);
+  free (pe->repeat_passphrase);
+  free (pe->repeat_error_string);
+  free (pe->quality_bar);
+  free (pe->quality_bar_tt);
+  free (pe->formatted_passphrase_hint);
+  free (pe->keyinfo);
+  free (pe->specific_err_info);
 
   /* Reset the pinentry structure.  */
-  memset (&pinentry, 0, sizeof (pinentry));
+  memset (pe, 0, sizeof *pe);
 
   /* Restore options without a default we want to preserve.  */
-  pinentry.invisible_char = invisible_char;
+  pe->invisible_char = invisible_char;
 
   /* Restore other options or set defaults.  */
 
   if (use_defaults)
     {
       /* Pinentry timeout in seconds.  */
-      pinentry.timeout = 60;
+      pe->timeout = 60;
 
       /* Global grab.  */
-      pinentry.grab = 1;
+      pe->grab = 1;
+
+      pe->color_fg = PINENTRY_COLOR_DEFAULT;
+      pe->color_fg_bright = 0;
+      pe->color_bg = PINENTRY_COLOR_DEFAULT;
+      pe->color_so = PINENTRY_COLOR_DEFAULT;
+      pe->color_so_bright = 0;
+      pe->color_ok = PINENTRY_COLOR_DEFAULT;
+      pe->color_ok_bright = 0;
+      pe->color_qualitybar = PINENTRY_COLOR_DEFAULT;
+      pe->color_qualitybar_bright = 0;
 
-      pinentry.color_fg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_fg_bright = 0;
-      pinentry.color_bg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so_bright = 0;
-      pinentry.color_ok = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_ok_bright = 0;
-      pinentry.color_qualitybar = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_qualitybar_bright = 0;
+      pe->owner_uid = -1;
 
-      pinentry.owner_uid = -1;
+      parse_quality_mode (DEFAULT_QUALITY_MODE, &pe->quality_mode);
     }
   else /* Restore the options.  */
     {
-      pinentry.grab = grab;
-      pinentry.ttyname = ttyname;
-      pinentry.ttytype_l = ttytype;
-      pinentry.ttyalert = ttyalert;
-      pinentry.lc_ctype = lc_ctype;
-      pinentry.lc_messages = lc_messages;
-      pinentry.allow_external_password_cache = allow_external_password_cache;
-      pinentry.default_ok = default_ok;
-      pinentry.default_cancel = default_cancel;
-      pinentry.default_prompt = default_prompt;
-      pinentry.default_pwmngr = default_pwmngr;
-      pinentry.default_cf_visi = default_cf_visi;
-      pinentry.default_tt_visi = default_tt_visi;
-      pinentry.default_tt_hide = default_tt_hide;
-      pinentry.default_capshint = default_capshint;
-      pinentry.touch_file = touch_file;
-      pinentry.owner_pid = owner_pid;
-      pinentry.owner_uid = owner_uid;
-      pinentry.owner_host = owner_host;
-      pinentry.constraints_enforce = constraints_enforce;
-      pinentry.constraints_hint_short = constraints_hint_short;
-      pinentry.constraints_hint_long = constraints_hint_long;
-      pinentry.constraints_error_title = constraints_error_title;
-
-      pinentry.debug = debug;
-      pinentry.display = display;
-      pinentry.parent_wid = parent_wid;
-
-      pinentry.color_fg = color_fg;
-      pinentry.color_fg_bright = color_fg_bright;
-      pinentry.color_bg = color_bg;
-      pinentry.color_so = color_so;
-      pinentry.color_so_bright = color_so_bright;
-      pinentry.color_ok = color_ok;
-      pinentry.color_ok_bright = color_ok_bright;
-      pinentry.color_qualitybar = color_qualitybar;
-      pinentry.color_qualitybar_bright = color_qualitybar_bright;
-
-      pinentry.timeout = timeout;
+      pe->grab = grab;
+      pe->ttyname = ttyname;
+      pe->ttytype_l = ttytype;
+      pe->ttyalert = ttyalert;
+      pe->lc_ctype = lc_ctype;
+      pe->lc_messages = lc_messages;
+      pe->allow_external_password_cache = allow_external_password_cache;
+      pe->default_ok = default_ok;
+      pe->default_cancel = default_cancel;
+      pe->default_prompt = default_prompt;
+      pe->default_pwmngr = default_pwmngr;
+      pe->default_cf_visi = default_cf_visi;
+      pe->default_tt_visi = default_tt_visi;
+      pe->default_tt_hide = default_tt_hide;
+      pe->default_capshint = default_capshint;
+      pe->touch_file = touch_file;
+      pe->owner_pid = owner_pid;
+      pe->owner_uid = owner_uid;
+      pe->owner_host = owner_host;
+      pe->constraints_enforce = constraints_enforce;
+      pe->quality_mode = quality_mode;
+      pe->constraints_hint_short = constraints_hint_short;
+      pe->constraints_hint_long = constraints_hint_long;
+      pe->constraints_error_title = constraints_error_title;
+
+      pe->debug = debug;
+      pe->display = display;
+      pe->parent_wid = parent_wid;
+
+      pe->color_fg = color_fg;
+      pe->color_fg_bright = color_fg_bright;
+      pe->color_bg = color_bg;
+      pe->color_so = color_so;
+      pe->color_so_bright = color_so_bright;
+      pe->color_ok = color_ok;
+      pe->color_ok_bright = color_ok_bright;
+      pe->color_qualitybar = color_qualitybar;
+      pe->color_qualitybar_bright = color_qualitybar_bright;
+
+      pe->timeout = timeout;
     }
 }
 
+/* Create a new session with the default options.  Returns NULL and
+   sets ERRNO on error.  */
+static session_t
+session_new (void)
+{
+  session_t session;
+  pinentry_t pe;
+  char **field;
+  int i;
+
+  session = calloc (1, sizeof *session);
+  if (!session)
+    return NULL;
+  pe = &session->pinentry;
+
+  *pe = pinentry_defaults;
+  for (i = 0; i < DIM (default_string_options); i++)
+    {
+      field = (char **)((char *)pe + default_string_options[i]);
+      if (*field && !(*field = strdup (*field)))
+        {
+          /* Do not free the strings still owned by the defaults.  */
+          for (; i < DIM (default_string_options); i++)
+            *(char **)((char *)pe + default_string_options[i]) = NULL;
+          pinentry_reset (pe, 1);
+          free (session);
+          return NULL;
+        }
+    }
+
+  session->cmd_handler = pinentry_cmd_handler;
+  return session;
+}
+
+
+/* Release SESSION and all its resources.  */
+static void
+session_release (session_t session)
+{
+  pinentry_t pe;
+
+  if (!session)
+    return;
+  pe = &session->pinentry;
+
+  /* These are not released by pinentry_reset.  */
+  free (pe->invisible_char);
+  pe->invisible_char = NULL;
+  free (pe->repeat_ok_string);
+  free (pe->genpin_label);
+  free (pe->genpin_tt);
+
+  pinentry_reset (pe, 1);
+  secmem_free (session->quality.pending_line);
+  quality_cache_release (session->quality.cache);
+  free (session);
+}
+
+
+/* Return the session attached to CTX.  */
+static session_t
+ctx_session (assuan_context_t ctx)
+{
+  return assuan_get_pointer (ctx);
+}
+
+
+/* Return the pinentry of the session attached to CTX.  */
+static pinentry_t
+ctx_pinentry (assuan_context_t ctx)
+{
+  return &ctx_session (ctx)->pinentry;
+}
+
+
 static gpg_error_t
 pinentry_assuan_reset_handler (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
   (void)line;
 
-  pinentry_reset (0);
+  pinentry_reset (ctx_pinentry (ctx), 0);
 
   return 0;
 }
 
 
 
+/* Libassuan allocates through these hooks.  Only its contexts, whose
+   line buffers see the passphrase, and what is allocated within a
+   confidential section go to the secure memory.  Everything else is
+   ordinary protocol traffic and uses the normal heap, so that the
+   small locked pool is kept for passphrases and is not wiped for each
+   status line.  A reallocated buffer stays where it is.  */
+static int assuan_secure_level;
+
+static void *
+assuan_malloc_hook (size_t n)
+{
+  return assuan_secure_level? secmem_malloc (n) : malloc (n);
+}
+
+
+static void *
+assuan_realloc_hook (void *p, size_t n)
+{
+  if (!p)
+    return assuan_malloc_hook (n);
+  return m_is_secure (p)? secmem_realloc (p, n) : realloc (p, n);
+}
+
+
+static void
+assuan_free_hook (void *p)
+{
+  if (m_is_secure (p))
+    secmem_free (p);
+  else
+    free (p);
+}
+
+
+static struct assuan_malloc_hooks assuan_malloc_hooks = {
+  assuan_malloc_hook, assuan_realloc_hook, assuan_free_hook
+};
+
+
+/* Create a new Assuan context in secure memory.  */
+static gpg_error_t
+new_assuan_context (assuan_context_t *r_ctx)
+{
+  gpg_error_t rc;
+
+  assuan_secure_level++;
+  rc = assuan_new (r_ctx);
+  assuan_secure_level--;
+  return rc;
+}
+
+
+/* Like assuan_begin_confidential but also let the allocations of
+   libassuan use the secure memory.  */
+static void
+begin_confidential (assuan_context_t ctx)
+{
+  assuan_secure_level++;
+  assuan_begin_confidential (ctx);
+}
+
+
+static void
+end_confidential (assuan_context_t ctx)
+{
+  assuan_end_confidential (ctx);
+  assuan_secure_level--;
+}
+
+
+/* Write the LINE with a passphrase to CTX.  */
+static gpg_error_t
+write_confidential_line (assuan_context_t ctx, const char *line)
+{
+  gpg_error_t rc;
+
+  begin_confidential (ctx);
+  rc = assuan_write_line (ctx, line);
+  end_confidential (ctx);
+  return rc;
+}
+
+
 /* Copy TEXT or TEXTLEN to BUFFER and escape as required.  Return a
    pointer to the end of the new buffer.  Note that BUFFER must be
    large enough to keep the entire text; allocataing it 3 times of
@@ -440,6 +716,416 @@ pinentry_get_title (pinentry_t pe)
 }
 
 
+/* Process the command LINE which was received while a dialog of PE
+   is open.  Such a command does not get a response because the
+   client is still waiting for the response to the GETPIN or CONFIRM
+   command.  Returns a set of PINENTRY_LIVE_* flags.  */
+static int
+do_live_command (pinentry_t pe, char *line)
+{
+  char *p;
+
+  if (!strncmp (line, "SETERROR", 8) && (!line[8] || line[8] == ' '))
+    {
+      for (line += 8; *line == ' '; line++)
+        ;
+      p = strdup (line);
+      if (!p)
+        return 0;
+      do_unescape_inplace (p);
+      free (pe->error);
+      pe->error = p;
+      return PINENTRY_LIVE_ERROR;
+    }
+  else if (!strncmp (line, "SETTIMEOUT", 10) && line[10] == ' ')
+    {
+      pe->timeout = atoi (line + 11);
+      return PINENTRY_LIVE_TIMEOUT;
+    }
+  else if (!strncmp (line, "CANCEL", 6) && (!line[6] || line[6] == ' '))
+    return PINENTRY_LIVE_CANCEL;
+
+  if (pe->debug)
+    fprintf (stderr, "pinentry: command ignored while the dialog is open:"
+             " %.30s\n", line);
+  return 0;
+}
+
+
+/* Return the file descriptor the frontend needs to watch for
+   commands arriving while the dialog of PE is open or -1 if this is
+   not possible.  If the descriptor becomes readable the frontend
+   shall call pinentry_process_input.  */
+int
+pinentry_get_input_fd (pinentry_t pe)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)pe;
+  return -1;
+#else
+  assuan_fd_t fds[2];
+
+  if (!pe->ctx_assuan)
+    return -1;
+  if (assuan_get_active_fds (pe->ctx_assuan, 0, fds, DIM (fds)) < 1)
+    return -1;
+  return fds[0];
+#endif
+}
+
+
+/* Return true if a line from the client of CTX can be read without
+   blocking.  A line may already be in the buffer of libassuan, in
+   which case the descriptor does not become readable for it.  */
+static int
+input_available (assuan_context_t ctx)
+{
+#ifdef HAVE_W32_SYSTEM
+  return assuan_pending_line (ctx);
+#else
+  assuan_fd_t fds[2];
+  struct pollfd pfd;
+
+  if (assuan_pending_line (ctx))
+    return 1;
+  if (assuan_get_active_fds (ctx, 0, fds, DIM (fds)) < 1)
+    return 0;
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  return poll (&pfd, 1, 0) > 0;
+#endif
+}
+
+
+/* Return true if commands from the client of PE are waiting to be
+   processed by pinentry_process_input.  Frontends call this once
+   after they started to watch the descriptor because commands sent
+   right behind GETPIN may already have been read into the buffer of
+   libassuan.  */
+int
+pinentry_input_pending (pinentry_t pe)
+{
+  if (!pe->ctx_assuan)
+    return 0;
+  return input_available (pe->ctx_assuan);
+}
+
+
+/* Forget the asynchronous quality inquiry of SESSION.  This is used
+   if the connection is broken.  */
+static void
+quality_abort (session_t session)
+{
+  secmem_free (session->quality.pending_line);
+  session->quality.pending_line = NULL;
+  session->quality.pending = 0;
+  session->quality.sent = 0;
+  session->quality.got_value = 0;
+  session->quality.result = 0;
+}
+
+
+/* Send the pending quality inquiry of the session attached to CTX if
+   no other inquiry is outstanding.  */
+static void
+quality_send_pending (assuan_context_t ctx)
+{
+  session_t session = ctx_session (ctx);
+  int rc;
+
+  if (session->quality.sent || !session->quality.pending)
+    return;
+
+  rc = write_confidential_line (ctx, session->quality.pending_line);
+  if (rc)
+    fprintf (stderr, "ASSUAN WRITE LINE failed: rc=%d\n", rc);
+  else
+    {
+      session->quality.sent = session->quality.pending;
+      session->quality.sent_hash = session->quality.pending_hash;
+      session->quality.sent_time = stats_now ();
+      session->quality.got_value = 0;
+    }
+  secmem_free (session->quality.pending_line);
+  session->quality.pending_line = NULL;
+  session->quality.pending = 0;
+}
+
+
+/* Process LINE of LINELEN received on CTX while a dialog is open.
+   This is either part of the response to an outstanding quality
+   inquiry or a command from the client.  */
+static void
+handle_input_line (assuan_context_t ctx, char *line, size_t linelen)
+{
+  session_t session = ctx_session (ctx);
+  int value;
+
+  if (!session->quality.sent)
+    {
+      session->live_flags |= do_live_command (&session->pinentry, line);
+      return;
+    }
+
+  if ((line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
+       && (!line[3] || line[3] == ' '))
+      || (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
+          && (!line[3] || line[3] == ' '))
+      || (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
+          && (!line[3] || line[3] == ' ')))
+    {
+      /* The inquiry is finished.  Only a result for the newest
+         request is of interest to the frontend.  */
+      stats_record (STATS_INQ_QUALITY, session->quality.sent_time);
+      trace_complete ("inquire-quality", session->quality.sent_time);
+      value = session->quality.value;
+      if (value < -100)
+        value = -100;
+      else if (value > 100)
+        value = 100;
+      if (session->quality.got_value && session->quality.cache
+          && session->quality.sent_hash)
+        quality_cache_put (session->quality.cache,
+                           session->quality.sent_hash, value);
+      if (session->quality.got_value
+          && session->quality.sent == session->quality.last)
+        {
+          session->quality.result = session->quality.sent;
+          session->quality.result_value = value;
+          session->live_flags |= PINENTRY_LIVE_QUALITY;
+        }
+      session->quality.sent = 0;
+      quality_send_pending (ctx);
+    }
+  else if (line[0] == 'D' && line[1] == ' ' && linelen >= 3)
+    {
+      if (!session->quality.got_value)
+        {
+          session->quality.got_value = 1;
+          session->quality.value = atoi (line + 2);
+        }
+    }
+  else if (line[0] != 'D')
+    session->live_flags |= do_live_command (&session->pinentry, line);
+}
+
+
+/* Wait until the asynchronous quality inquiries of the session
+   attached to CTX are finished.  If DISCARD is set, a request not yet
+   sent is dropped and no result is kept.  This must be called before
+   another inquiry is started or the command finishes.  */
+static void
+quality_drain (assuan_context_t ctx, int discard)
+{
+  session_t session = ctx_session (ctx);
+  char *line;
+  size_t linelen;
+  int rc;
+
+  if (discard)
+    {
+      secmem_free (session->quality.pending_line);
+      session->quality.pending_line = NULL;
+      session->quality.pending = 0;
+    }
+
+  while (session->quality.sent)
+    {
+      rc = assuan_read_line (ctx, &line, &linelen);
+      if (rc)
+        {
+          fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
+          session->live_flags |= PINENTRY_LIVE_CANCEL;
+          quality_abort (session);
+          break;
+        }
+      if (*line == '#' || !linelen)
+        continue;
+      handle_input_line (ctx, line, linelen);
+    }
+
+  if (discard)
+    {
+      session->quality.result = 0;
+      quality_cache_release (session->quality.cache);
+      session->quality.cache = NULL;
+    }
+}
+
+
+/* Read and process the commands which arrived while the dialog of PE
+   is open.  This is called if the descriptor returned by
+   pinentry_get_input_fd is readable or pinentry_input_pending
+   returned true; it never waits for input.  Returns a set of
+   PINENTRY_LIVE_* flags telling the frontend which parts of PE
+   changed.  If the connection to the client is lost,
+   PINENTRY_LIVE_CANCEL is returned.  */
+int
+pinentry_process_input (pinentry_t pe)
+{
+  assuan_context_t ctx = pe->ctx_assuan;
+  session_t session;
+  char *line;
+  size_t linelen;
+  int flags;
+  int rc;
+
+  if (!ctx)
+    return 0;
+  session = ctx_session (ctx);
+
+  /* Check before each read so that a spurious wakeup does not block
+     the event loop of the frontend.  */
+  while (input_available (ctx))
+    {
+      rc = assuan_read_line (ctx, &line, &linelen);
+      if (rc)
+        {
+          session->live_flags |= PINENTRY_LIVE_CANCEL;
+          quality_abort (session);
+          break;
+        }
+      if (*line == '#' || !linelen)
+        continue;
+      handle_input_line (ctx, line, linelen);
+    }
+
+  flags = session->live_flags;
+  session->live_flags = 0;
+  return flags;
+}
+
+
+/* Tell the core that the user provided input to the dialog of PE.
+   This is used to record the time until the first input.  */
+void
+pinentry_note_input (pinentry_t pe)
+{
+  session_t session;
+
+  trace_event ('i', "keystroke");
+  if (!pe->ctx_assuan)
+    return;
+  session = ctx_session (pe->ctx_assuan);
+  if (session->got_input)
+    return;
+  session->got_input = 1;
+  stats_record (STATS_FIRST_INPUT, session->dialog_start);
+}
+
+
+/* Public wrappers for the trace module.  */
+void
+pinentry_trace_begin (const char *name)
+{
+  trace_event ('B', name);
+}
+
+
+void
+pinentry_trace_end (const char *name)
+{
+  trace_event ('E', name);
+}
+
+
+void
+pinentry_trace_mark (const char *name)
+{
+  trace_event ('i', name);
+}
+
+
+/* Return true if the response to an inquiry has been read from CTX
+   and store the data line, if any, at R_VALUE.  Commands received
+   while waiting for the response are processed and remembered for
+   pinentry_process_input.  */
+static int
+read_inquiry_response (assuan_context_t ctx, char **r_value)
+{
+  pinentry_t pe = ctx_pinentry (ctx);
+  char *line;
+  size_t linelen;
+  int rc;
+
+  *r_value = NULL;
+  for (;;)
+    {
+      do
+        {
+          rc = assuan_read_line (ctx, &line, &linelen);
+          if (rc)
+            {
+              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
+              ctx_session (ctx)->live_flags |= PINENTRY_LIVE_CANCEL;
+              free (*r_value);
+              *r_value = NULL;
+              return 0;
+            }
+        }
+      while (*line == '#' || !linelen);
+      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
+          && (!line[3] || line[3] == ' '))
+        break; /* END command received*/
+      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
+          && (!line[3] || line[3] == ' '))
+        break; /* CAN command received*/
+      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
+          && (!line[3] || line[3] == ' '))
+        break; /* ERR command received*/
+      if (line[0] == 'D' && line[1] == ' ' && linelen >= 3)
+        {
+          if (!*r_value)
+            *r_value = strdup (line + 2);
+          continue;
+        }
+      if (line[0] != 'D')
+        ctx_session (ctx)->live_flags |= do_live_command (pe, line);
+    }
+
+  return 1;
+}
+
+
+/* Look up the quality inquiry LINE in the cache of SESSION, which is
+   created on first use.  If a result is known, store it at R_VALUE
+   and return true.  The hash of LINE is stored at R_HASH; it is 0 if
+   there is no cache.  */
+static int
+quality_cache_lookup (session_t session, const char *line,
+                      uint64_t *r_hash, int *r_value)
+{
+  *r_hash = 0;
+  if (!session->quality.cache)
+    session->quality.cache = quality_cache_new ();
+  if (!session->quality.cache)
+    return 0;
+
+  *r_hash = quality_cache_hash (session->quality.cache, line);
+  return quality_cache_get (session->quality.cache, *r_hash, r_value);
+}
+
+
+/* Return a secmem allocated INQUIRE line with PREFIX followed by the
+   escaped PASSPHRASE of LENGTH or NULL on error.  */
+static char *
+make_inquire_line (const char *prefix, const char *passphrase, size_t length)
+{
+  char *command;
+
+  if (length > 300)
+    length = 300;  /* Limit so that it definitely fits into an Assuan
+                      line.  */
+
+  command = secmem_malloc (strlen (prefix) + 3*length + 1);
+  if (!command)
+    return NULL;
+  strcpy (command, prefix);
+  copy_and_escape (command + strlen(command), passphrase, length);
+  return command;
+}
+
+
 /* Run a quality inquiry for PASSPHRASE of LENGTH.  (We need LENGTH
    because not all backends might be able to return a proper
    C-string.).  Returns: A value between -100 and 100 to give an
@@ -455,24 +1141,29 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
   const char prefix[] = "INQUIRE QUALITY ";
   char *command;
   char *line;
-  size_t linelen;
-  int gotvalue = 0;
+  uint64_t hash;
+  uint64_t start;
   int value = 0;
   int rc;
 
+  if (pin->quality_mode == PINENTRY_QUALITY_LOCAL)
+    return passphrase_quality_estimate (passphrase, length);
+
   if (!ctx)
     return 0; /* Can't run the callback.  */
 
-  if (length > 300)
-    length = 300;  /* Limit so that it definitely fits into an Assuan
-                      line.  */
-
-  command = secmem_malloc (strlen (prefix) + 3*length + 1);
+  command = make_inquire_line (prefix, passphrase, length);
   if (!command)
     return 0;
-  strcpy (command, prefix);
-  copy_and_escape (command + strlen(command), passphrase, length);
-  rc = assuan_write_line (ctx, command);
+  if (quality_cache_lookup (ctx_session (ctx), command, &hash, &value))
+    {
+      secmem_free (command);
+      return value;
+    }
+
+  quality_drain (ctx, 0);
+  start = stats_now ();
+  rc = write_confidential_line (ctx, command);
   secmem_free (command);
   if (rc)
     {
@@ -480,38 +1171,117 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
       return 0;
     }
 
-  for (;;)
+  rc = read_inquiry_response (ctx, &line);
+  stats_record (STATS_INQ_QUALITY, start);
+  trace_complete ("inquire-quality", start);
+  if (rc && line)
+    {
+      value = atoi (line);
+      free (line);
+      if (value < -100)
+        value = -100;
+      else if (value > 100)
+        value = 100;
+      if (hash && ctx_session (ctx)->quality.cache)
+        quality_cache_put (ctx_session (ctx)->quality.cache, hash, value);
+    }
+
+  return value;
+}
+
+
+/* Estimate the quality of PASSPHRASE of LENGTH without asking the
+   caller and store it at R_VALUE.  Returns true if the estimate shall
+   be shown, i.e. if the quality mode is local or hybrid.  In hybrid
+   mode the frontend shall replace the estimate by the result of the
+   inquiry when that arrives.  */
+int
+pinentry_quality_estimate (pinentry_t pin,
+                           const char *passphrase, size_t length,
+                           int *r_value)
+{
+  if (pin->quality_mode == PINENTRY_QUALITY_AGENT)
+    return 0;
+
+  *r_value = passphrase_quality_estimate (passphrase, length);
+  return 1;
+}
+
+
+/* Start an asynchronous quality inquiry for PASSPHRASE of LENGTH.
+   Returns a handle for the request or 0 if no inquiry can be run.
+   The descriptor to watch for the response is stored at R_FD.  When
+   it becomes readable the frontend calls pinentry_process_input; if
+   that returns PINENTRY_LIVE_QUALITY the result can be fetched with
+   pinentry_inq_quality_collect.  A request which is superseded by a
+   newer one before its response arrived is never reported and, if it
+   has not yet been sent, not even sent.  If the result is already
+   known from an earlier request, it can be collected right away.  */
+int
+pinentry_inq_quality_submit (pinentry_t pin,
+                             const char *passphrase, size_t length,
+                             int *r_fd)
+{
+  assuan_context_t ctx = pin->ctx_assuan;
+  session_t session;
+  char *command;
+  uint64_t hash;
+  int value;
+
+  *r_fd = pinentry_get_input_fd (pin);
+  if (!ctx || *r_fd == -1 || pin->quality_mode == PINENTRY_QUALITY_LOCAL)
+    return 0;
+  session = ctx_session (ctx);
+
+  command = make_inquire_line ("INQUIRE QUALITY ", passphrase, length);
+  if (!command)
+    return 0;
+
+  if (session->quality.last == INT_MAX)
+    session->quality.last = 0;
+  session->quality.last++;
+
+  /* A request for a known passphrase supersedes the pending one as
+     well but is answered right away.  */
+  secmem_free (session->quality.pending_line);
+  session->quality.pending_line = NULL;
+  session->quality.pending = 0;
+  if (quality_cache_lookup (session, command, &hash, &value))
     {
-      do
-        {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              return 0;
-            }
-        }
-      while (*line == '#' || !linelen);
-      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
-          && (!line[3] || line[3] == ' '))
-        break; /* END command received*/
-      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
-          && (!line[3] || line[3] == ' '))
-        break; /* CAN command received*/
-      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
-          && (!line[3] || line[3] == ' '))
-        break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
-        continue;
-      gotvalue = 1;
-      value = atoi (line+2);
+      secmem_free (command);
+      session->quality.result = session->quality.last;
+      session->quality.result_value = value;
+      return session->quality.last;
     }
-  if (value < -100)
-    value = -100;
-  else if (value > 100)
-    value = 100;
 
-  return value;
+  session->quality.pending_line = command;
+  session->quality.pending = session->quality.last;
+  session->quality.pending_hash = hash;
+  quality_send_pending (ctx);
+
+  return session->quality.last;
+}
+
+
+/* Return the handle of the request for which a quality result is
+   available and store the result at R_VALUE.  Returns 0 if there is
+   no new result.  */
+int
+pinentry_inq_quality_collect (pinentry_t pin, int *r_value)
+{
+  assuan_context_t ctx = pin->ctx_assuan;
+  session_t session;
+  int handle;
+
+  if (!ctx)
+    return 0;
+  session = ctx_session (ctx);
+
+  handle = session->quality.result;
+  if (handle)
+    *r_value = session->quality.result_value;
+  session->quality.result = 0;
+  return handle;
 }
 
 
@@ -522,25 +1292,19 @@ pinentry_inq_checkpin (pinentry_t pin, const char *passphrase, size_t length)
   assuan_context_t ctx = pin->ctx_assuan;
   const char prefix[] = "INQUIRE CHECKPIN ";
   char *command;
-  char *line;
-  size_t linelen;
-  int gotvalue = 0;
-  char *value = NULL;
+  char *value;
+  uint64_t start;
   int rc;
 
   if (!ctx)
     return 0; /* Can't run the callback.  */
 
-  if (length > 300)
-    length = 300;  /* Limit so that it definitely fits into an Assuan
-                      line.  */
-
-  command = secmem_malloc (strlen (prefix) + 3*length + 1);
+  quality_drain (ctx, 0);
+  command = make_inquire_line (prefix, passphrase, length);
   if (!command)
     return 0;
-  strcpy (command, prefix);
-  copy_and_escape (command + strlen(command), passphrase, length);
-  rc = assuan_write_line (ctx, command);
+  start = stats_now ();
+  rc = write_confidential_line (ctx, command);
   secmem_free (command);
   if (rc)
     {
@@ -548,32 +1312,9 @@ pinentry_inq_checkpin (pinentry_t pin, const char *passphrase, size_t length)
       return 0;
     }
 
-  for (;;)
-    {
-      do
-        {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              return 0;
-            }
-        }
-      while (*line == '#' || !linelen);
-      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
-          && (!line[3] || line[3] == ' '))
-        break; /* END command received*/
-      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
-          && (!line[3] || line[3] == ' '))
-        break; /* CAN command received*/
-      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
-          && (!line[3] || line[3] == ' '))
-        break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
-        continue;
-      gotvalue = 1;
-      value = strdup (line + 2);
-    }
+  read_inquiry_response (ctx, &value);
+  stats_record (STATS_INQ_CHECKPIN, start);
+  trace_complete ("inquire-checkpin", start);
 
   return value;
 }
@@ -585,15 +1326,15 @@ pinentry_inq_genpin (pinentry_t pin)
 {
   assuan_context_t ctx = pin->ctx_assuan;
   const char prefix[] = "INQUIRE GENPIN";
-  char *line;
-  size_t linelen;
-  int gotvalue = 0;
-  char *value = NULL;
+  char *value;
+  uint64_t start;
   int rc;
 
   if (!ctx)
     return 0; /* Can't run the callback.  */
 
+  quality_drain (ctx, 0);
+  start = stats_now ();
   rc = assuan_write_line (ctx, prefix);
   if (rc)
     {
@@ -601,33 +1342,9 @@ pinentry_inq_genpin (pinentry_t pin)
       return 0;
     }
 
-  for (;;)
-    {
-      do
-        {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              free (value);
-              return 0;
-            }
-        }
-      while (*line == '#' || !linelen);
-      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
-          && (!line[3] || line[3] == ' '))
-        break; /* END command received*/
-      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
-          && (!line[3] || line[3] == ' '))
-        break; /* CAN command received*/
-      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
-          && (!line[3] || line[3] == ' '))
-        break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
-        continue;
-      gotvalue = 1;
-      value = strdup (line + 2);
-    }
+  read_inquiry_response (ctx, &value);
+  stats_record (STATS_INQ_GENPIN, start);
+  trace_complete ("inquire-genpin", start);
 
   return value;
 }
@@ -711,15 +1428,15 @@ pinentry_setbuffer_use (pinentry_t pin, char *passphrase, int len)
   pin->pin_len = len;
 }
 
-static struct assuan_malloc_hooks assuan_malloc_hooks = {
-  secmem_malloc, secmem_realloc, secmem_free
-};
-
 /* Initialize the secure memory subsystem, drop privileges and return.
    Must be called early. */
 void
 pinentry_init (const char *pgmname)
 {
+  const char *s;
+
+  trace_event ('B', "pinentry-init");
+
   /* Store away our name. */
   if (strlen (pgmname) > sizeof this_pgmname - 2)
     abort ();
@@ -730,7 +1447,10 @@ pinentry_init (const char *pgmname)
   /* Initialize secure memory.  1 is too small, so the default size
      will be used.  */
   secmem_init (1);
-  secmem_set_flags (SECMEM_WARN);
+  secmem_set_flags (secmem_get_flags () | SECMEM_WARN);
+#ifdef ENABLE_SECMEM_WIPE_ONCE
+  secmem_set_flags (secmem_get_flags () | SECMEM_WIPE_ONCE);
+#endif
   drop_privs ();
 
   if (atexit (secmem_term))
@@ -739,6 +1459,20 @@ pinentry_init (const char *pgmname)
     }
 
   assuan_set_malloc_hooks (&assuan_malloc_hooks);
+
+  /* The trace file may also be given in the environment, so that the
+     startup can be traced when pinentry is started by gpg-agent.  */
+  s = getenv ("PINENTRY_TRACE");
+  if (s && *s)
+    {
+      if (trace_set_file (s))
+        fprintf (stderr, "%s: can't trace to '%s': %s\n",
+                 this_pgmname, s, strerror (errno));
+      else
+        trace_file_set = 1;
+    }
+
+  trace_event ('E', "pinentry-init");
 }
 
 /* Simple test to check whether DISPLAY is set or the option --display
@@ -893,6 +1627,7 @@ parse_color (char *arg, pinentry_color_t *color_p, int *bright_p)
 void
 pinentry_parse_opts (int argc, char *argv[])
 {
+  enum { oListen = 500, oTrace };
   static ARGPARSE_OPTS opts[] = {
     ARGPARSE_s_n('d', "debug",    "Turn on debugging output"),
     ARGPARSE_s_s('D', "display",  "|DISPLAY|Set the X display"),
@@ -907,111 +1642,142 @@ pinentry_parse_opts (int argc, char *argv[])
     ARGPARSE_s_u('W', "parent-wid", "Parent window ID (for positioning)"),
     ARGPARSE_s_s('c', "colors", "|STRING|Set custom colors for ncurses"),
     ARGPARSE_s_s('a', "ttyalert", "|STRING|Set the alert mode (none, beep or flash)"),
+    ARGPARSE_o_s(oListen, "listen",
+                 "|SOCKET|Serve requests on a Unix domain socket"),
+    ARGPARSE_s_s(oTrace, "trace",
+                 "|FILE|Write a timeline of the run to FILE at exit"),
     ARGPARSE_end()
   };
   ARGPARSE_ARGS pargs = { &argc, &argv, 0 };
 
+  trace_event ('B', "parse-opts");
   set_strusage (my_strusage);
 
-  pinentry_reset (1);
+  pinentry_reset (&pinentry_defaults, 1);
 
   while (arg_parse  (&pargs, opts))
     {
       switch (pargs.r_opt)
         {
         case 'd':
-          pinentry.debug = 1;
+          pinentry_defaults.debug = 1;
           break;
         case 'g':
-          pinentry.grab = 0;
+          pinentry_defaults.grab = 0;
           break;
 
 	case 'D':
           /* Note, this is currently not used because the GUI engine
              has already been initialized when parsing these options. */
-	  pinentry.display = strdup (pargs.r.ret_str);
-	  if (!pinentry.display)
+	  pinentry_defaults.display = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.display)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'T':
-	  pinentry.ttyname = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyname)
+	  pinentry_defaults.ttyname = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.ttyname)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'N':
-	  pinentry.ttytype_l = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttytype_l)
+	  pinentry_defaults.ttytype_l = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.ttytype_l)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'C':
-	  pinentry.lc_ctype = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_ctype)
+	  pinentry_defaults.lc_ctype = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.lc_ctype)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'M':
-	  pinentry.lc_messages = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_messages)
+	  pinentry_defaults.lc_messages = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.lc_messages)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'W':
-	  pinentry.parent_wid = pargs.r.ret_ulong;
+	  pinentry_defaults.parent_wid = pargs.r.ret_ulong;
 	  break;
 
 	case 'c':
           {
             char *tmpstr = pargs.r.ret_str;
 
-            tmpstr = parse_color (tmpstr, &pinentry.color_fg,
-                                  &pinentry.color_fg_bright);
-            tmpstr = parse_color (tmpstr, &pinentry.color_bg, NULL);
-            tmpstr = parse_color (tmpstr, &pinentry.color_so,
-                                  &pinentry.color_so_bright);
-            tmpstr = parse_color (tmpstr, &pinentry.color_ok,
-                                  &pinentry.color_ok_bright);
-            tmpstr = parse_color (tmpstr, &pinentry.color_qualitybar,
-                                  &pinentry.color_qualitybar_bright);
+            tmpstr = parse_color (tmpstr, &pinentry_defaults.color_fg,
+                                  &pinentry_defaults.color_fg_bright);
+            tmpstr = parse_color (tmpstr, &pinentry_defaults.color_bg, NULL);
+            tmpstr = parse_color (tmpstr, &pinentry_defaults.color_so,
+                                  &pinentry_defaults.color_so_bright);
+            tmpstr = parse_color (tmpstr, &pinentry_defaults.color_ok,
+                                  &pinentry_defaults.color_ok_bright);
+            tmpstr = parse_color (tmpstr, &pinentry_defaults.color_qualitybar,
+                                  &pinentry_defaults.color_qualitybar_bright);
           }
 	  break;
 
 	case 'o':
-	  pinentry.timeout = pargs.r.ret_int;
+	  pinentry_defaults.timeout = pargs.r.ret_int;
 	  break;
 
 	case 'a':
-	  pinentry.ttyalert = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyalert)
+	  pinentry_defaults.ttyalert = strdup (pargs.r.ret_str);
+	  if (!pinentry_defaults.ttyalert)
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 
+        case oListen:
+          listen_mode = 1;
+          free (listen_socket_name);
+          listen_socket_name = NULL;
+          if (pargs.r_type && pargs.r.ret_str && *pargs.r.ret_str)
+            {
+              listen_socket_name = strdup (pargs.r.ret_str);
+              if (!listen_socket_name)
+                {
+                  fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
+                  exit (EXIT_FAILURE);
+                }
+            }
+          break;
+
+        case oTrace:
+          if (trace_set_file (pargs.r.ret_str))
+            {
+              fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
+              exit (EXIT_FAILURE);
+            }
+          trace_file_set = 1;
+          break;
+
         default:
           pargs.err = ARGPARSE_PRINT_WARNING;
 	  break;
         }
     }
 
-  if (!pinentry.display && remember_display)
+  if (!pinentry_defaults.display && remember_display)
     {
-      pinentry.display = remember_display;
+      pinentry_defaults.display = remember_display;
       remember_display = NULL;
     }
+
+  trace_event ('E', "parse-opts");
 }
 
 
@@ -1023,17 +1789,115 @@ pinentry_set_flavor_flag (const char *string)
 }
 
 
+/* Set the features returned by GETINFO features. */
+void
+pinentry_set_features (unsigned int features)
+{
+  frontend_features = features;
+}
+
+
+/* Write the names of the features of the frontend separated by
+   spaces to BUFFER of SIZE.  */
+static void
+format_features (char *buffer, size_t size)
+{
+  unsigned int features = frontend_features;
+  size_t n = 0;
+  int i;
+
+#ifndef HAVE_LIBSECRET
+  /* Without libsecret the cache is never used.  */
+  features &= ~PINENTRY_FEATURE_EXTERNAL_CACHE;
+#endif
+
+  *buffer = 0;
+  for (i = 0; i < DIM (feature_names); i++)
+    if ((features & (1 << i))
+        && n + 1 + strlen (feature_names[i]) < size)
+      n += sprintf (buffer + n, "%s%s", n? " ":"", feature_names[i]);
+}
+
+
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Return a malloced name for the file BASE in the private directory
+   "$XDG_RUNTIME_DIR/pinentry".  The directory is created if needed.
+   Returns NULL and sets ERRNO on error.  */
+static char *
+private_file_name (const char *base)
+{
+  const char *rundir = getenv ("XDG_RUNTIME_DIR");
+  struct stat st;
+  char *name;
+  size_t n;
+
+  if (!rundir || !*rundir)
+    {
+      errno = ENOENT;
+      return NULL;
+    }
+
+  n = strlen (rundir) + strlen ("/pinentry/") + strlen (base) + 1;
+  name = malloc (n);
+  if (!name)
+    return NULL;
+  snprintf (name, n, "%s/pinentry", rundir);
+  if (mkdir (name, 0700) && errno != EEXIST)
+    {
+      free (name);
+      return NULL;
+    }
+  /* The directory must be ours and not accessible by others because
+     we rely on it to restrict access to the files in it.  */
+  if (stat (name, &st) || !S_ISDIR (st.st_mode)
+      || st.st_uid != getuid () || (st.st_mode & 077))
+    {
+      fprintf (stderr, "%s: unsafe permissions on '%s'\n",
+               this_pgmname, name);
+      free (name);
+      errno = EPERM;
+      return NULL;
+    }
+  snprintf (name, n, "%s/pinentry/%s", rundir, base);
+  return name;
+}
+
+
+/* Write the trace to "$XDG_RUNTIME_DIR/pinentry/trace-PID.json".  This
+   is used for OPTION trace, which must not let the client choose the
+   file we write to.  */
+static gpg_error_t
+set_default_trace_file (void)
+{
+  char base[40];
+  char *name;
+  int rc;
+
+  snprintf (base, sizeof base, "trace-%lu.json", (unsigned long)getpid ());
+  name = private_file_name (base);
+  if (!name)
+    return gpg_error_from_syserror ();
+  rc = trace_set_file (name);
+  free (name);
+  return rc ? gpg_error_from_syserror () : 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* Handle OPTION KEY=VALUE.  Note that SETDIALOG accepts only the keys
+   listed in DIALOG_OPTIONS below; a new option which may also be given
+   to SETDIALOG must be added there as well.  */
 static gpg_error_t
 option_handler (assuan_context_t ctx, const char *key, const char *value)
 {
-  (void)ctx;
+  pinentry_t pe = ctx_pinentry (ctx);
 
   if (!strcmp (key, "no-grab") && !*value)
-    pinentry.grab = 0;
+    pe->grab = 0;
   else if (!strcmp (key, "grab") && !*value)
-    pinentry.grab = 1;
+    pe->grab = 1;
   else if (!strcmp (key, "debug-wait"))
     {
 #ifndef HAVE_W32_SYSTEM
@@ -1041,54 +1905,73 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 	       this_pgmname, (unsigned int) getpid());
       sleep (*value?atoi (value):5);
       fprintf (stderr, "%s: ... okay\n", this_pgmname);
+#endif
+    }
+  else if (!strcmp (key, "trace"))
+    {
+      /* The client may only switch tracing on; the file is either the
+         one given on the command line or in the environment, or a
+         fixed one in our private directory.  */
+      if (*value)
+        return gpg_error (GPG_ERR_INV_VALUE);
+#ifdef HAVE_W32_SYSTEM
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#else
+      if (!trace_file_set)
+        {
+          gpg_error_t err = set_default_trace_file ();
+          if (err)
+            return err;
+          trace_file_set = 1;
+        }
 #endif
     }
   else if (!strcmp (key, "display"))
     {
-      if (pinentry.display)
-	free (pinentry.display);
-      pinentry.display = strdup (value);
-      if (!pinentry.display)
+      if (pe->display)
+	free (pe->display);
+      pe->display = strdup (value);
+      if (!pe->display)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "ttyname"))
     {
-      if (pinentry.ttyname)
-	free (pinentry.ttyname);
-      pinentry.ttyname = strdup (value);
-      if (!pinentry.ttyname)
+      if (pe->ttyname)
+	free (pe->ttyname);
+      pe->ttyname = strdup (value);
+      if (!pe->ttyname)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "ttytype"))
     {
-      if (pinentry.ttytype_l)
-	free (pinentry.ttytype_l);
-      pinentry.ttytype_l = strdup (value);
-      if (!pinentry.ttytype_l)
+      if (pe->ttytype_l)
+	free (pe->ttytype_l);
+      pe->ttytype_l = strdup (value);
+      if (!pe->ttytype_l)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "ttyalert"))
     {
-      if (pinentry.ttyalert)
-	free (pinentry.ttyalert);
-      pinentry.ttyalert = strdup (value);
-      if (!pinentry.ttyalert)
+      if (pe->ttyalert)
+	free (pe->ttyalert);
+      pe->ttyalert = strdup (value);
+      if (!pe->ttyalert)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "lc-ctype"))
     {
-      if (pinentry.lc_ctype)
-	free (pinentry.lc_ctype);
-      pinentry.lc_ctype = strdup (value);
-      if (!pinentry.lc_ctype)
+      if (pe->lc_ctype)
+	free (pe->lc_ctype);
+      pe->lc_ctype = strdup (value);
+      if (!pe->lc_ctype)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "lc-messages"))
     {
-      if (pinentry.lc_messages)
-	free (pinentry.lc_messages);
-      pinentry.lc_messages = strdup (value);
-      if (!pinentry.lc_messages)
+      if (pe->lc_messages)
+	free (pe->lc_messages);
+      pe->lc_messages = strdup (value);
+      if (!pe->lc_messages)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "owner"))
@@ -1096,16 +1979,16 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
       long along;
       char *endp;
 
-      free (pinentry.owner_host);
-      pinentry.owner_host = NULL;
-      pinentry.owner_uid = -1;
-      pinentry.owner_pid = 0;
+      free (pe->owner_host);
+      pe->owner_host = NULL;
+      pe->owner_uid = -1;
+      pe->owner_pid = 0;
 
       errno = 0;
       along = strtol (value, &endp, 10);
       if (along && !errno)
         {
-          pinentry.owner_pid = (unsigned long)along;
+          pe->owner_pid = (unsigned long)along;
           if (*endp)
             {
               errno = 0;
@@ -1113,7 +1996,7 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
                 endp++;
                 along = strtol (endp, &endp, 10);
                 if (along >= 0 && !errno)
-                  pinentry.owner_uid = (int)along;
+                  pe->owner_uid = (int)along;
               }
               if (endp)
                 {
@@ -1121,8 +2004,8 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
                     endp++;
                   if (*endp)
                     {
-                      pinentry.owner_host = strdup (endp);
-                      for (endp=pinentry.owner_host;
+                      pe->owner_host = strdup (endp);
+                      for (endp=pe->owner_host;
                            *endp && *endp != ' '; endp++)
                         ;
                       *endp = 0;
@@ -1133,127 +2016,133 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
     }
   else if (!strcmp (key, "parent-wid"))
     {
-      pinentry.parent_wid = atoi (value);
+      pe->parent_wid = atoi (value);
       /* FIXME: Use strtol and add some error handling.  */
     }
   else if (!strcmp (key, "touch-file"))
     {
-      if (pinentry.touch_file)
-        free (pinentry.touch_file);
-      pinentry.touch_file = strdup (value);
-      if (!pinentry.touch_file)
+      if (pe->touch_file)
+        free (pe->touch_file);
+      pe->touch_file = strdup (value);
+      if (!pe->touch_file)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-ok"))
     {
-      pinentry.default_ok = strdup (value);
-      if (!pinentry.default_ok)
+      pe->default_ok = strdup (value);
+      if (!pe->default_ok)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-cancel"))
     {
-      pinentry.default_cancel = strdup (value);
-      if (!pinentry.default_cancel)
+      pe->default_cancel = strdup (value);
+      if (!pe->default_cancel)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-prompt"))
     {
-      pinentry.default_prompt = strdup (value);
-      if (!pinentry.default_prompt)
+      pe->default_prompt = strdup (value);
+      if (!pe->default_prompt)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-pwmngr"))
     {
-      pinentry.default_pwmngr = strdup (value);
-      if (!pinentry.default_pwmngr)
+      pe->default_pwmngr = strdup (value);
+      if (!pe->default_pwmngr)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-cf-visi"))
     {
-      pinentry.default_cf_visi = strdup (value);
-      if (!pinentry.default_cf_visi)
+      pe->default_cf_visi = strdup (value);
+      if (!pe->default_cf_visi)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-tt-visi"))
     {
-      pinentry.default_tt_visi = strdup (value);
-      if (!pinentry.default_tt_visi)
+      pe->default_tt_visi = strdup (value);
+      if (!pe->default_tt_visi)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-tt-hide"))
     {
-      pinentry.default_tt_hide = strdup (value);
-      if (!pinentry.default_tt_hide)
+      pe->default_tt_hide = strdup (value);
+      if (!pe->default_tt_hide)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "default-capshint"))
     {
-      pinentry.default_capshint = strdup (value);
-      if (!pinentry.default_capshint)
+      pe->default_capshint = strdup (value);
+      if (!pe->default_capshint)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "allow-external-password-cache") && !*value)
     {
       char *desktop = getenv ("XDG_SESSION_DESKTOP");
       char *kde_use_wallet = getenv ("PINENTRY_KDE_USE_WALLET");
-      pinentry.allow_external_password_cache = (!desktop || strcmp (desktop, "KDE") || (kde_use_wallet && *kde_use_wallet));
-      pinentry.tried_password_cache = 0;
+      pe->allow_external_password_cache = (!desktop || strcmp (desktop, "KDE") || (kde_use_wallet && *kde_use_wallet));
+      pe->tried_password_cache = 0;
     }
   else if (!strcmp (key, "allow-emacs-prompt") && !*value)
     {
 #ifdef INSIDE_EMACS
       pinentry_enable_emacs_cmd_handler ();
+      ctx_session (ctx)->cmd_handler = pinentry_cmd_handler;
 #endif
     }
   else if (!strcmp (key, "invisible-char"))
     {
-      if (pinentry.invisible_char)
-        free (pinentry.invisible_char);
-      pinentry.invisible_char = strdup (value);
-      if (!pinentry.invisible_char)
+      if (pe->invisible_char)
+        free (pe->invisible_char);
+      pe->invisible_char = strdup (value);
+      if (!pe->invisible_char)
 	return gpg_error_from_syserror ();
     }
   else if (!strcmp (key, "formatted-passphrase") && !*value)
     {
-      pinentry.formatted_passphrase = 1;
+      pe->formatted_passphrase = 1;
     }
   else if (!strcmp (key, "formatted-passphrase-hint"))
     {
-      if (pinentry.formatted_passphrase_hint)
-        free (pinentry.formatted_passphrase_hint);
-      pinentry.formatted_passphrase_hint = strdup (value);
-      if (!pinentry.formatted_passphrase_hint)
+      if (pe->formatted_passphrase_hint)
+        free (pe->formatted_passphrase_hint);
+      pe->formatted_passphrase_hint = strdup (value);
+      if (!pe->formatted_passphrase_hint)
 	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.formatted_passphrase_hint);
+      do_unescape_inplace(pe->formatted_passphrase_hint);
     }
   else if (!strcmp (key, "constraints-enforce") && !*value)
-    pinentry.constraints_enforce = 1;
+    pe->constraints_enforce = 1;
+  else if (!strcmp (key, "quality-mode"))
+    {
+      if (!parse_quality_mode (value, &pe->quality_mode))
+        return gpg_error (GPG_ERR_INV_VALUE);
+    }
   else if (!strcmp (key, "constraints-hint-short"))
     {
-      if (pinentry.constraints_hint_short)
-        free (pinentry.constraints_hint_short);
-      pinentry.constraints_hint_short = strdup (value);
-      if (!pinentry.constraints_hint_short)
+      if (pe->constraints_hint_short)
+        free (pe->constraints_hint_short);
+      pe->constraints_hint_short = strdup (value);
+      if (!pe->constraints_hint_short)
 	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_hint_short);
+      do_unescape_inplace(pe->constraints_hint_short);
     }
   else if (!strcmp (key, "constraints-hint-long"))
     {
-      if (pinentry.constraints_hint_long)
-        free (pinentry.constraints_hint_long);
-      pinentry.constraints_hint_long = strdup (value);
-      if (!pinentry.constraints_hint_long)
+      if (pe->constraints_hint_long)
+        free (pe->constraints_hint_long);
+      pe->constraints_hint_long = strdup (value);
+      if (!pe->constraints_hint_long)
 	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_hint_long);
+      do_unescape_inplace(pe->constraints_hint_long);
     }
   else if (!strcmp (key, "constraints-error-title"))
     {
-      if (pinentry.constraints_error_title)
-        free (pinentry.constraints_error_title);
-      pinentry.constraints_error_title = strdup (value);
-      if (!pinentry.constraints_error_title)
+      if (pe->constraints_error_title)
+        free (pe->constraints_error_title);
+      pe->constraints_error_title = strdup (value);
+      if (!pe->constraints_error_title)
 	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_error_title);
+      do_unescape_inplace(pe->constraints_error_title);
     }
   else
     return gpg_error (GPG_ERR_UNKNOWN_OPTION);
@@ -1305,18 +2194,17 @@ write_status_error (assuan_context_t ctx, pinentry_t pe)
 static gpg_error_t
 cmd_setdesc (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newd;
 
-  (void)ctx;
-
   newd = malloc (strlen (line) + 1);
   if (!newd)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newd, line);
-  if (pinentry.description)
-    free (pinentry.description);
-  pinentry.description = newd;
+  if (pe->description)
+    free (pe->description);
+  pe->description = newd;
   return 0;
 }
 
@@ -1324,18 +2212,17 @@ cmd_setdesc (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setprompt (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newp;
 
-  (void)ctx;
-
   newp = malloc (strlen (line) + 1);
   if (!newp)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newp, line);
-  if (pinentry.prompt)
-    free (pinentry.prompt);
-  pinentry.prompt = newp;
+  if (pe->prompt)
+    free (pe->prompt);
+  pe->prompt = newp;
   return 0;
 }
 
@@ -1347,15 +2234,15 @@ cmd_setprompt (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setkeyinfo (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
+  pinentry_t pe = ctx_pinentry (ctx);
 
-  if (pinentry.keyinfo)
-    free (pinentry.keyinfo);
+  if (pe->keyinfo)
+    free (pe->keyinfo);
 
   if (*line && strcmp(line, "--clear") != 0)
-    pinentry.keyinfo = strdup (line);
+    pe->keyinfo = strdup (line);
   else
-    pinentry.keyinfo = NULL;
+    pe->keyinfo = NULL;
 
   return 0;
 }
@@ -1364,34 +2251,32 @@ cmd_setkeyinfo (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setrepeat (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *p;
 
-  (void)ctx;
-
   p = malloc (strlen (line) + 1);
   if (!p)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (p, line);
-  free (pinentry.repeat_passphrase);
-  pinentry.repeat_passphrase = p;
+  free (pe->repeat_passphrase);
+  pe->repeat_passphrase = p;
   return 0;
 }
 
 static gpg_error_t
 cmd_setrepeatok (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *p;
 
-  (void)ctx;
-
   p = malloc (strlen (line) + 1);
   if (!p)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (p, line);
-  free (pinentry.repeat_ok_string);
-  pinentry.repeat_ok_string = p;
+  free (pe->repeat_ok_string);
+  pe->repeat_ok_string = p;
   return 0;
 }
 
@@ -1399,17 +2284,16 @@ cmd_setrepeatok (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setrepeaterror (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *p;
 
-  (void)ctx;
-
   p = malloc (strlen (line) + 1);
   if (!p)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (p, line);
-  free (pinentry.repeat_error_string);
-  pinentry.repeat_error_string = p;
+  free (pe->repeat_error_string);
+  pe->repeat_error_string = p;
   return 0;
 }
 
@@ -1417,18 +2301,17 @@ cmd_setrepeaterror (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_seterror (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newe;
 
-  (void)ctx;
-
   newe = malloc (strlen (line) + 1);
   if (!newe)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newe, line);
-  if (pinentry.error)
-    free (pinentry.error);
-  pinentry.error = newe;
+  if (pe->error)
+    free (pe->error);
+  pe->error = newe;
   return 0;
 }
 
@@ -1436,18 +2319,17 @@ cmd_seterror (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setok (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newo;
 
-  (void)ctx;
-
   newo = malloc (strlen (line) + 1);
   if (!newo)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newo, line);
-  if (pinentry.ok)
-    free (pinentry.ok);
-  pinentry.ok = newo;
+  if (pe->ok)
+    free (pe->ok);
+  pe->ok = newo;
   return 0;
 }
 
@@ -1455,18 +2337,17 @@ cmd_setok (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setnotok (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newo;
 
-  (void)ctx;
-
   newo = malloc (strlen (line) + 1);
   if (!newo)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newo, line);
-  if (pinentry.notok)
-    free (pinentry.notok);
-  pinentry.notok = newo;
+  if (pe->notok)
+    free (pe->notok);
+  pe->notok = newo;
   return 0;
 }
 
@@ -1474,18 +2355,17 @@ cmd_setnotok (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setcancel (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newc;
 
-  (void)ctx;
-
   newc = malloc (strlen (line) + 1);
   if (!newc)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newc, line);
-  if (pinentry.cancel)
-    free (pinentry.cancel);
-  pinentry.cancel = newc;
+  if (pe->cancel)
+    free (pe->cancel);
+  pe->cancel = newc;
   return 0;
 }
 
@@ -1493,10 +2373,10 @@ cmd_setcancel (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_settimeout (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
+  pinentry_t pe = ctx_pinentry (ctx);
 
   if (line && *line)
-    pinentry.timeout = atoi (line);
+    pe->timeout = atoi (line);
 
   return 0;
 }
@@ -1504,28 +2384,26 @@ cmd_settimeout (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_settitle (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newt;
 
-  (void)ctx;
-
   newt = malloc (strlen (line) + 1);
   if (!newt)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newt, line);
-  if (pinentry.title)
-    free (pinentry.title);
-  pinentry.title = newt;
+  if (pe->title)
+    free (pe->title);
+  pe->title = newt;
   return 0;
 }
 
 static gpg_error_t
 cmd_setqualitybar (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newval;
 
-  (void)ctx;
-
   if (!*line)
     line = "Quality:";
 
@@ -1534,9 +2412,9 @@ cmd_setqualitybar (assuan_context_t ctx, char *line)
     return gpg_error_from_syserror ();
 
   strcpy_escaped (newval, line);
-  if (pinentry.quality_bar)
-    free (pinentry.quality_bar);
-  pinentry.quality_bar = newval;
+  if (pe->quality_bar)
+    free (pe->quality_bar);
+  pe->quality_bar = newval;
   return 0;
 }
 
@@ -1544,10 +2422,9 @@ cmd_setqualitybar (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setqualitybar_tt (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newval;
 
-  (void)ctx;
-
   if (*line)
     {
       newval = malloc (strlen (line) + 1);
@@ -1558,9 +2435,9 @@ cmd_setqualitybar_tt (assuan_context_t ctx, char *line)
     }
   else
     newval = NULL;
-  if (pinentry.quality_bar_tt)
-    free (pinentry.quality_bar_tt);
-  pinentry.quality_bar_tt = newval;
+  if (pe->quality_bar_tt)
+    free (pe->quality_bar_tt);
+  pe->quality_bar_tt = newval;
   return 0;
 }
 
@@ -1568,9 +2445,31 @@ cmd_setqualitybar_tt (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setgenpin_tt (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   char *newval;
 
-  (void)ctx;
+  if (*line)
+    {
+      newval = malloc (strlen (line) + 1);
+      if (!newval)
+        return gpg_error_from_syserror ();
+
+      strcpy_escaped (newval, line);
+    }
+  else
+    newval = NULL;
+  if (pe->genpin_tt)
+    free (pe->genpin_tt);
+  pe->genpin_tt = newval;
+  return 0;
+}
+
+/* Set the label to be used for a generate action.  */
+static gpg_error_t
+cmd_setgenpin_label (assuan_context_t ctx, char *line)
+{
+  pinentry_t pe = ctx_pinentry (ctx);
+  char *newval;
 
   if (*line)
     {
@@ -1578,90 +2477,274 @@ cmd_setgenpin_tt (assuan_context_t ctx, char *line)
       if (!newval)
         return gpg_error_from_syserror ();
 
-      strcpy_escaped (newval, line);
+      strcpy_escaped (newval, line);
+    }
+  else
+    newval = NULL;
+  if (pe->genpin_label)
+    free (pe->genpin_label);
+  pe->genpin_label = newval;
+  return 0;
+}
+
+/* Run the frontend's command handler for the session attached to
+   CTX and return its result.  */
+static int
+run_cmd_handler (assuan_context_t ctx)
+{
+  session_t session = ctx_session (ctx);
+  int result;
+
+  session->dialog_start = stats_now ();
+  session->got_input = 0;
+  result = (*session->cmd_handler) (&session->pinentry);
+  stats_record (STATS_HANDLER, session->dialog_start);
+  trace_complete ("cmd-handler", session->dialog_start);
+  return result;
+}
+
+
+/* The fields of SETDIALOG which correspond to a SET command.  All
+   other fields are processed like an OPTION.  */
+static const struct
+{
+  const char *name;
+  gpg_error_t (*handler) (assuan_context_t, char *line);
+} dialog_fields[] =
+  {
+    { "title",         cmd_settitle },
+    { "desc",          cmd_setdesc },
+    { "prompt",        cmd_setprompt },
+    { "keyinfo",       cmd_setkeyinfo },
+    { "error",         cmd_seterror },
+    { "ok",            cmd_setok },
+    { "notok",         cmd_setnotok },
+    { "cancel",        cmd_setcancel },
+    { "timeout",       cmd_settimeout },
+    { "repeat",        cmd_setrepeat },
+    { "repeat-error",  cmd_setrepeaterror },
+    { "repeat-ok",     cmd_setrepeatok },
+    { "qualitybar",    cmd_setqualitybar },
+    { "qualitybar-tt", cmd_setqualitybar_tt },
+    { "genpin",        cmd_setgenpin_label },
+    { "genpin-tt",     cmd_setgenpin_tt }
+  };
+
+
+/* The options which may be given to SETDIALOG.  The options with
+   global side effects (debug-wait, trace and allow-emacs-prompt) are
+   only accepted by OPTION.  This list must be kept in sync with the
+   keys handled by option_handler.  */
+#define DIALOG_OPT_FLAG    1  /* The option takes no value.  */
+#define DIALOG_OPT_ESCAPED 2  /* option_handler unescapes the value.  */
+static const struct
+{
+  const char *name;
+  int flags;
+} dialog_options[] =
+  {
+    { "no-grab",                       DIALOG_OPT_FLAG },
+    { "grab",                          DIALOG_OPT_FLAG },
+    { "display",                       0 },
+    { "ttyname",                       0 },
+    { "ttytype",                       0 },
+    { "ttyalert",                      0 },
+    { "lc-ctype",                      0 },
+    { "lc-messages",                   0 },
+    { "owner",                         0 },
+    { "parent-wid",                    0 },
+    { "touch-file",                    0 },
+    { "default-ok",                    0 },
+    { "default-cancel",                0 },
+    { "default-prompt",                0 },
+    { "default-pwmngr",                0 },
+    { "default-cf-visi",               0 },
+    { "default-tt-visi",               0 },
+    { "default-tt-hide",               0 },
+    { "default-capshint",              0 },
+    { "allow-external-password-cache", DIALOG_OPT_FLAG },
+    { "invisible-char",                0 },
+    { "formatted-passphrase",          DIALOG_OPT_FLAG },
+    { "formatted-passphrase-hint",     DIALOG_OPT_ESCAPED },
+    { "constraints-enforce",           DIALOG_OPT_FLAG },
+    { "quality-mode",                  0 },
+    { "constraints-hint-short",        DIALOG_OPT_ESCAPED },
+    { "constraints-hint-long",         DIALOG_OPT_ESCAPED },
+    { "constraints-error-title",       DIALOG_OPT_ESCAPED }
+  };
+
+
+/* Check the option at IDX of DIALOG_OPTIONS with the unescaped VALUE
+   without applying it.  */
+static gpg_error_t
+check_dialog_option (int idx, const char *value)
+{
+  pinentry_quality_mode_t mode;
+
+  if ((dialog_options[idx].flags & DIALOG_OPT_FLAG) && *value)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+  if (!strcmp (dialog_options[idx].name, "quality-mode")
+      && !parse_quality_mode (value, &mode))
+    return gpg_error (GPG_ERR_INV_VALUE);
+  return 0;
+}
+
+
+/* Apply the space separated KEY=VALUE fields of LINE to the session
+   attached to CTX.  The values are percent-escaped just like the
+   arguments of the corresponding commands.  If CHECK_ONLY is set,
+   the options are only checked; the SET commands are still run
+   because they only change the session.  LINE is modified.  */
+static gpg_error_t
+apply_dialog_fields (assuan_context_t ctx, char *line, int check_only)
+{
+  char *key, *value, *end;
+  gpg_error_t err;
+  int i;
+
+  for (key = line; *key; key = end)
+    {
+      if (*key == ' ')
+        {
+          end = key + 1;
+          continue;
+        }
+
+      end = strchr (key, ' ');
+      if (end)
+        *end++ = 0;
+      else
+        end = key + strlen (key);
+
+      value = strchr (key, '=');
+      if (value)
+        *value++ = 0;
+      else
+        value = key + strlen (key);
+
+      for (i = 0; i < DIM (dialog_fields); i++)
+        if (!strcmp (key, dialog_fields[i].name))
+          break;
+      if (i < DIM (dialog_fields))
+        {
+          err = dialog_fields[i].handler (ctx, value);
+          if (err)
+            return err;
+          continue;
+        }
+
+      for (i = 0; i < DIM (dialog_options); i++)
+        if (!strcmp (key, dialog_options[i].name))
+          break;
+      if (i == DIM (dialog_options))
+        return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+      if (!(dialog_options[i].flags & DIALOG_OPT_ESCAPED))
+        do_unescape_inplace (value);
+      if (check_only)
+        err = check_dialog_option (i, value);
+      else
+        err = option_handler (ctx, key, value);
+      if (err)
+        return err;
     }
-  else
-    newval = NULL;
-  if (pinentry.genpin_tt)
-    free (pinentry.genpin_tt);
-  pinentry.genpin_tt = newval;
+
   return 0;
 }
 
-/* Set the label to be used for a generate action.  */
-static gpg_error_t
-cmd_setgenpin_label (assuan_context_t ctx, char *line)
-{
-  char *newval;
-
-  (void)ctx;
 
-  if (*line)
-    {
-      newval = malloc (strlen (line) + 1);
-      if (!newval)
-        return gpg_error_from_syserror ();
+/* SETDIALOG FIELD=VALUE...
 
-      strcpy_escaped (newval, line);
-    }
-  else
-    newval = NULL;
-  if (pinentry.genpin_label)
-    free (pinentry.genpin_label);
-  pinentry.genpin_label = newval;
-  return 0;
+   Set up the next dialog in one go.  Each field either names a SET
+   command (e.g. "desc=Enter%20PIN" for SETDESC) or an option
+   (e.g. "default-ok=_OK").  Either all fields are applied or, if one
+   of them is invalid, none.  */
+static gpg_error_t
+cmd_setdialog (assuan_context_t ctx, char *line)
+{
+  session_t session = ctx_session (ctx);
+  session_t scratch;
+  char *copy;
+  gpg_error_t err;
+
+  /* Check the fields by applying them to a scratch session first;
+     options are not applied but only checked.  The second run can
+     then only fail if we are out of core.  */
+  scratch = session_new ();
+  copy = strdup (line);
+  if (!scratch || !copy)
+    {
+      err = gpg_error_from_syserror ();
+      session_release (scratch);
+      free (copy);
+      return err;
+    }
+  assuan_set_pointer (ctx, scratch);
+  err = apply_dialog_fields (ctx, copy, 1);
+  assuan_set_pointer (ctx, session);
+  session_release (scratch);
+  free (copy);
+  if (err)
+    return err;
+
+  return apply_dialog_fields (ctx, line, 0);
 }
 
+
 static gpg_error_t
-cmd_getpin (assuan_context_t ctx, char *line)
+do_getpin (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
+  uint64_t start;
   int result;
   int set_prompt = 0;
   int just_read_password_from_cache = 0;
 
   (void)line;
 
-  pinentry_setbuffer_init (&pinentry);
-  if (!pinentry.pin)
+  pinentry_setbuffer_init (pe);
+  if (!pe->pin)
     return gpg_error (GPG_ERR_ENOMEM);
 
-  pinentry.confirm = 0;
+  pe->confirm = 0;
 
   /* Try reading from the password cache.  */
   if (/* If repeat passphrase is set, then we don't want to read from
 	 the cache.  */
-      ! pinentry.repeat_passphrase
+      ! pe->repeat_passphrase
       /* Are we allowed to read from the cache?  */
-      && pinentry.allow_external_password_cache
-      && pinentry.keyinfo
+      && pe->allow_external_password_cache
+      && pe->keyinfo
       /* Only read from the cache if we haven't already tried it.  */
-      && ! pinentry.tried_password_cache
+      && ! pe->tried_password_cache
       /* If the last read resulted in an error, then don't read from
 	 the cache.  */
-      && ! pinentry.error)
+      && ! pe->error)
     {
       char *password;
       int give_up_on_password_store = 0;
 
-      pinentry.tried_password_cache = 1;
+      pe->tried_password_cache = 1;
 
-      password = password_cache_lookup (pinentry.keyinfo, &give_up_on_password_store);
+      start = stats_now ();
+      password = password_cache_lookup (pe->keyinfo, &give_up_on_password_store);
+      stats_record (STATS_CACHE_LOOKUP, start);
+      trace_complete ("cache-lookup", start);
       if (give_up_on_password_store)
-	pinentry.allow_external_password_cache = 0;
+	pe->allow_external_password_cache = 0;
 
       if (password)
 	/* There is a cached password.  Try it.  */
 	{
 	  int len = strlen(password) + 1;
-	  if (len > pinentry.pin_len)
-	    len = pinentry.pin_len;
+	  if (len > pe->pin_len)
+	    len = pe->pin_len;
 
-	  memcpy (pinentry.pin, password, len);
-	  pinentry.pin[len] = '\0';
+	  memcpy (pe->pin, password, len);
+	  pe->pin[len] = '\0';
 
 	  secmem_free (password);
 
-	  pinentry.pin_from_cache = 1;
+	  pe->pin_from_cache = 1;
 
 	  assuan_write_status (ctx, "PASSWORD_FROM_CACHE", "");
 
@@ -1677,55 +2760,57 @@ cmd_getpin (assuan_context_t ctx, char *line)
 
   /* The password was not cached (or we are not allowed to / cannot
      use the cache).  Prompt the user.  */
-  pinentry.pin_from_cache = 0;
+  pe->pin_from_cache = 0;
 
-  if (!pinentry.prompt)
+  if (!pe->prompt)
     {
-      pinentry.prompt = pinentry.default_prompt?pinentry.default_prompt:"PIN:";
+      pe->prompt = pe->default_prompt?pe->default_prompt:"PIN:";
       set_prompt = 1;
     }
-  pinentry.locale_err = 0;
-  pinentry.specific_err = 0;
-  pinentry.specific_err_loc = NULL;
-  free (pinentry.specific_err_info);
-  pinentry.specific_err_info = NULL;
-  pinentry.close_button = 0;
-  pinentry.repeat_okay = 0;
-  pinentry.one_button = 0;
-  pinentry.ctx_assuan = ctx;
-  result = (*pinentry_cmd_handler) (&pinentry);
-  pinentry.ctx_assuan = NULL;
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
-  if (pinentry.repeat_passphrase)
-    {
-      free (pinentry.repeat_passphrase);
-      pinentry.repeat_passphrase = NULL;
+  pe->locale_err = 0;
+  pe->specific_err = 0;
+  pe->specific_err_loc = NULL;
+  free (pe->specific_err_info);
+  pe->specific_err_info = NULL;
+  pe->close_button = 0;
+  pe->repeat_okay = 0;
+  pe->one_button = 0;
+  pe->ctx_assuan = ctx;
+  ctx_session (ctx)->live_flags = 0;
+  result = run_cmd_handler (ctx);
+  quality_drain (ctx, 1);
+  pe->ctx_assuan = NULL;
+  if (pe->error)
+    {
+      free (pe->error);
+      pe->error = NULL;
+    }
+  if (pe->repeat_passphrase)
+    {
+      free (pe->repeat_passphrase);
+      pe->repeat_passphrase = NULL;
     }
   if (set_prompt)
-    pinentry.prompt = NULL;
+    pe->prompt = NULL;
 
-  pinentry.quality_bar = 0;  /* Reset it after the command.  */
+  pe->quality_bar = 0;  /* Reset it after the command.  */
 
-  if (pinentry.close_button)
+  if (pe->close_button)
     assuan_write_status (ctx, "BUTTON_INFO", "close");
 
   if (result < 0)
     {
-      pinentry_setbuffer_clear (&pinentry);
-      if (pinentry.specific_err)
+      pinentry_setbuffer_clear (pe);
+      if (pe->specific_err)
         {
-          write_status_error (ctx, &pinentry);
+          write_status_error (ctx, pe);
 
-          if (gpg_err_code (pinentry.specific_err) == GPG_ERR_FULLY_CANCELED)
+          if (gpg_err_code (pe->specific_err) == GPG_ERR_FULLY_CANCELED)
             assuan_set_flag (ctx, ASSUAN_FORCE_CLOSE, 1);
 
-          return pinentry.specific_err;
+          return pe->specific_err;
         }
-      return (pinentry.locale_err
+      return (pe->locale_err
 	      ? gpg_error (GPG_ERR_LOCALE_PROBLEM)
 	      : gpg_error (GPG_ERR_CANCELED));
     }
@@ -1733,30 +2818,50 @@ cmd_getpin (assuan_context_t ctx, char *line)
  out:
   if (result)
     {
-      if (pinentry.repeat_okay)
+      if (pe->repeat_okay)
         assuan_write_status (ctx, "PIN_REPEATED", "");
-      assuan_begin_confidential (ctx);
-      result = assuan_send_data (ctx, pinentry.pin, strlen(pinentry.pin));
+      begin_confidential (ctx);
+      trace_event ('B', "send-data");
+      result = assuan_send_data (ctx, pe->pin, strlen(pe->pin));
       if (!result)
 	result = assuan_send_data (ctx, NULL, 0);
-      assuan_end_confidential (ctx);
+      trace_event ('E', "send-data");
+      end_confidential (ctx);
 
       if (/* GPG Agent says it's okay.  */
-	  pinentry.allow_external_password_cache && pinentry.keyinfo
+	  pe->allow_external_password_cache && pe->keyinfo
 	  /* We didn't just read it from the cache.  */
 	  && ! just_read_password_from_cache
 	  /* And the user said it's okay.  */
-	  && pinentry.may_cache_password)
+	  && pe->may_cache_password)
 	/* Cache the password.  */
-	password_cache_save (pinentry.keyinfo, pinentry.pin);
+	{
+	  start = stats_now ();
+	  password_cache_save (pe->keyinfo, pe->pin);
+	  stats_record (STATS_CACHE_SAVE, start);
+	  trace_complete ("cache-save", start);
+	}
     }
 
-  pinentry_setbuffer_clear (&pinentry);
+  pinentry_setbuffer_clear (pe);
 
   return result;
 }
 
 
+static gpg_error_t
+cmd_getpin (assuan_context_t ctx, char *line)
+{
+  uint64_t start = stats_now ();
+  gpg_error_t err;
+
+  err = do_getpin (ctx, line);
+  stats_record (STATS_GETPIN, start);
+  trace_complete ("getpin", start);
+  return err;
+}
+
+
 /* Note that the option --one-button is a hack to allow the use of old
    pinentries while the caller is ignoring the result.  Given that
    options have never been used or flagged as an error the new option
@@ -1765,56 +2870,74 @@ cmd_getpin (assuan_context_t ctx, char *line)
    command.  New applications which are free to require an updated
    pinentry should use MESSAGE instead. */
 static gpg_error_t
-cmd_confirm (assuan_context_t ctx, char *line)
+do_confirm (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   int result;
 
-  pinentry.one_button = !!strstr (line, "--one-button");
-  pinentry.quality_bar = 0;
-  pinentry.close_button = 0;
-  pinentry.locale_err = 0;
-  pinentry.specific_err = 0;
-  pinentry.specific_err_loc = NULL;
-  free (pinentry.specific_err_info);
-  pinentry.specific_err_info = NULL;
-  pinentry.canceled = 0;
-  pinentry.confirm = 1;
-  pinentry_setbuffer_clear (&pinentry);
-  result = (*pinentry_cmd_handler) (&pinentry);
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
-
-  if (pinentry.close_button)
+  pe->one_button = !!strstr (line, "--one-button");
+  pe->quality_bar = 0;
+  pe->close_button = 0;
+  pe->locale_err = 0;
+  pe->specific_err = 0;
+  pe->specific_err_loc = NULL;
+  free (pe->specific_err_info);
+  pe->specific_err_info = NULL;
+  pe->canceled = 0;
+  pe->confirm = 1;
+  pinentry_setbuffer_clear (pe);
+  pe->ctx_assuan = ctx;
+  ctx_session (ctx)->live_flags = 0;
+  result = run_cmd_handler (ctx);
+  quality_drain (ctx, 1);
+  pe->ctx_assuan = NULL;
+  if (pe->error)
+    {
+      free (pe->error);
+      pe->error = NULL;
+    }
+
+  if (pe->close_button)
     assuan_write_status (ctx, "BUTTON_INFO", "close");
 
   if (result > 0)
     return 0; /* OK */
 
-  if (pinentry.specific_err)
+  if (pe->specific_err)
     {
-      write_status_error (ctx, &pinentry);
+      write_status_error (ctx, pe);
 
-      if (gpg_err_code (pinentry.specific_err) == GPG_ERR_FULLY_CANCELED)
+      if (gpg_err_code (pe->specific_err) == GPG_ERR_FULLY_CANCELED)
         assuan_set_flag (ctx, ASSUAN_FORCE_CLOSE, 1);
 
-      return pinentry.specific_err;
+      return pe->specific_err;
     }
 
-  if (pinentry.locale_err)
+  if (pe->locale_err)
     return gpg_error (GPG_ERR_LOCALE_PROBLEM);
 
-  if (pinentry.one_button)
+  if (pe->one_button)
     return 0; /* OK */
 
-  if (pinentry.canceled)
+  if (pe->canceled)
     return gpg_error (GPG_ERR_CANCELED);
   return gpg_error (GPG_ERR_NOT_CONFIRMED);
 }
 
 
+static gpg_error_t
+cmd_confirm (assuan_context_t ctx, char *line)
+{
+  uint64_t start = stats_now ();
+  gpg_error_t err;
+
+  err = do_confirm (ctx, line);
+  stats_record (STATS_CONFIRM, start);
+  trace_complete ("confirm", start);
+  return err;
+}
+
+
 static gpg_error_t
 cmd_message (assuan_context_t ctx, char *line)
 {
@@ -1859,13 +2982,18 @@ device_stat_string (const char *device)
      pid         - Return the process id of the server.
      flavor      - Return information about the used pinentry flavor
      ttyinfo     - Return DISPLAY, ttyinfo and an emacs pinentry status
+     features    - Return the features of the frontend
+     stats       - Return the latency statistics
+     secmem      - Return the counters of the secure memory
+     setdialog   - Return the fields of SETDIALOG
  */
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
+  pinentry_t pe = ctx_pinentry (ctx);
   int rc;
   const char *s;
-  char buffer[150];
+  char buffer[250];
 
   if (!strcmp (line, "version"))
     {
@@ -1890,8 +3018,16 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 flavor_flag? ":":"",
                 flavor_flag? flavor_flag : "");
       rc = assuan_send_data (ctx, buffer, strlen (buffer));
-      /* if (!rc) */
-      /*   rc = assuan_write_status (ctx, "FEATURES", "tabbing foo bar"); */
+      if (!rc)
+        {
+          format_features (buffer, sizeof buffer);
+          rc = assuan_write_status (ctx, "FEATURES", buffer);
+        }
+    }
+  else if (!strcmp (line, "features"))
+    {
+      format_features (buffer, sizeof buffer);
+      rc = assuan_send_data (ctx, buffer, strlen (buffer));
     }
   else if (!strcmp (line, "ttyinfo"))
     {
@@ -1903,10 +3039,10 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       strcpy (emacs_status, "-");
 #endif
       snprintf (buffer, sizeof buffer, "%s %s %s %s %lu/%lu %s",
-                pinentry.ttyname? pinentry.ttyname : "-",
-                pinentry.ttytype_l? pinentry.ttytype_l : "-",
-                pinentry.display? pinentry.display : "-",
-                device_stat_string (pinentry.ttyname),
+                pe->ttyname? pe->ttyname : "-",
+                pe->ttytype_l? pe->ttytype_l : "-",
+                pe->display? pe->display : "-",
+                device_stat_string (pe->ttyname),
 #ifdef HAVE_DOSISH_SYSTEM
                 0l, 0l,
 #else
@@ -1916,6 +3052,62 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 );
       rc = assuan_send_data (ctx, buffer, strlen (buffer));
     }
+  else if (!strcmp (line, "stats"))
+    {
+      /* Return one line per operation.  See stats_format.  */
+      int i;
+
+      for (i = rc = 0; i < STATS_LAST && !rc; i++)
+        {
+          if (stats_format (i, buffer, sizeof buffer - 1) < 0)
+            continue;
+          strcat (buffer, "\n");
+          rc = assuan_send_data (ctx, buffer, strlen (buffer));
+        }
+    }
+  else if (!strcmp (line, "secmem"))
+    {
+      /* Return one "NAME VALUE" line per counter.  */
+      struct secmem_stats st;
+
+      secmem_get_stats (&st);
+      snprintf (buffer, sizeof buffer,
+                "cur-bytes %lu\nmax-bytes %lu\n"
+                "cur-blocks %u\nmax-blocks %u\n"
+                "pool-size %lu\npool-used %lu\npool-max %lu\n"
+                "segments %d\n",
+                (unsigned long)st.cur_alloced, (unsigned long)st.max_alloced,
+                st.cur_blocks, st.max_blocks,
+                (unsigned long)st.poolsize, (unsigned long)st.poollen,
+                (unsigned long)secmem_get_max_size (),
+                st.segments);
+      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+      if (!rc)
+        {
+          snprintf (buffer, sizeof buffer,
+                    "free-bytes %lu\nfree-blocks %u\nlargest-free %lu\n"
+                    "failed-allocs %lu\nmerged-blocks %lu\nmlock %s\n",
+                    (unsigned long)st.free_bytes, st.free_blocks,
+                    (unsigned long)st.largest_free,
+                    st.failed_allocs, st.merged_blocks,
+                    !st.locked_segments? "no" :
+                    st.locked_segments < st.segments? "partial" : "yes");
+          rc = assuan_send_data (ctx, buffer, strlen (buffer));
+        }
+    }
+  else if (!strcmp (line, "setdialog"))
+    {
+      /* Return the fields of SETDIALOG which are not options.  */
+      int i;
+
+      for (i = rc = 0; i < DIM (dialog_fields) && !rc; i++)
+        {
+          s = dialog_fields[i].name;
+          rc = assuan_send_data (ctx, s, strlen (s));
+          if (!rc && i + 1 < DIM (dialog_fields))
+            rc = assuan_send_data (ctx, " ", 1);
+        }
+    }
   else
     rc = gpg_error (GPG_ERR_ASS_PARAMETER);
   return rc;
@@ -1978,6 +3170,7 @@ register_commands (assuan_context_t ctx)
       { "GETINFO",    cmd_getinfo },
       { "SETTITLE",   cmd_settitle },
       { "SETTIMEOUT", cmd_settimeout },
+      { "SETDIALOG",  cmd_setdialog },
       { "CLEARPASSPHRASE", cmd_clear_passphrase },
       { NULL }
     };
@@ -1994,6 +3187,84 @@ register_commands (assuan_context_t ctx)
 }
 
 
+/* Attach a new session to CTX and register our commands and
+   notification handlers.  */
+static gpg_error_t
+setup_server (assuan_context_t ctx)
+{
+  gpg_error_t rc;
+  session_t session;
+
+  session = session_new ();
+  if (!session)
+    {
+      rc = gpg_error_from_syserror ();
+      fprintf (stderr, "%s: failed to create session: %s\n",
+               this_pgmname, gpg_strerror (rc));
+      return rc;
+    }
+  assuan_set_pointer (ctx, session);
+
+  rc = register_commands (ctx);
+  if (rc)
+    {
+      fprintf (stderr, "%s: failed to the register commands with Assuan: %s\n",
+               this_pgmname, gpg_strerror (rc));
+      return rc;
+    }
+
+  assuan_register_option_handler (ctx, option_handler);
+#if 0
+  assuan_set_log_stream (ctx, stderr);
+#endif
+  assuan_register_reset_notify (ctx, pinentry_assuan_reset_handler);
+  return 0;
+}
+
+
+/* Release CTX and the session attached to it.  */
+static void
+release_server (assuan_context_t ctx)
+{
+  session_t session = ctx_session (ctx);
+
+  assuan_release (ctx);
+  session_release (session);
+}
+
+
+/* Process Assuan requests on CTX until the client closes the
+   connection.  */
+static void
+serve_connection (assuan_context_t ctx)
+{
+  gpg_error_t rc;
+
+  for (;;)
+    {
+      rc = assuan_accept (ctx);
+      if (rc == -1)
+          break;
+      else if (rc)
+        {
+          fprintf (stderr, "%s: Assuan accept problem: %s\n",
+                   this_pgmname, gpg_strerror (rc));
+          break;
+        }
+
+      trace_event ('B', "session");
+      rc = assuan_process (ctx);
+      trace_event ('E', "session");
+      if (rc)
+        {
+          fprintf (stderr, "%s: Assuan processing failed: %s\n",
+                   this_pgmname, gpg_strerror (rc));
+          continue;
+        }
+    }
+}
+
+
 int
 pinentry_loop2 (int infd, int outfd)
 {
@@ -2007,7 +3278,7 @@ pinentry_loop2 (int infd, int outfd)
     abort ();
 #endif
 
-  rc = assuan_new (&ctx);
+  rc = new_assuan_context (&ctx);
   if (rc)
     {
       fprintf (stderr, "server context creation failed: %s\n",
@@ -2015,9 +3286,8 @@ pinentry_loop2 (int infd, int outfd)
       return -1;
     }
 
-  /* For now we use a simple pipe based server so that we can work
-     from scripts.  We will later add options to run as a daemon and
-     wait for requests on a Unix domain socket.  */
+  /* This is the simple pipe based server so that we can work from
+     scripts.  See pinentry_listen_loop for the daemon mode.  */
   filedes[0] = assuan_fdopen (infd);
   filedes[1] = assuan_fdopen (outfd);
   rc = assuan_init_pipe_server (ctx, filedes);
@@ -2027,44 +3297,266 @@ pinentry_loop2 (int infd, int outfd)
                this_pgmname, gpg_strerror (rc));
       return -1;
     }
-  rc = register_commands (ctx);
+  if (setup_server (ctx))
+    {
+      release_server (ctx);
+      return -1;
+    }
+
+  serve_connection (ctx);
+
+  release_server (ctx);
+  return 0;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* The name of the socket we are listening on or NULL.  Used to remove
+   the socket at exit.  */
+static char *listen_socket_in_use;
+
+static void
+remove_listen_socket (void)
+{
+  if (listen_socket_in_use)
+    remove (listen_socket_in_use);
+}
+
+
+/* Remove the socket when we are terminated by a signal and then
+   terminate with the default action of the signal.  */
+static void
+listen_term_handler (int sig)
+{
+  if (listen_socket_in_use)
+    unlink (listen_socket_in_use);
+  signal (sig, SIG_DFL);
+  raise (sig);
+}
+
+
+/* Return a malloced string with the default name of the listening
+   socket, which is "$XDG_RUNTIME_DIR/pinentry/S.PGMNAME".  Returns
+   NULL and sets ERRNO on error.  */
+static char *
+default_listen_socket_name (void)
+{
+  char *base, *name;
+  size_t n;
+
+  if (!getenv ("XDG_RUNTIME_DIR") || !*getenv ("XDG_RUNTIME_DIR"))
+    {
+      fprintf (stderr, "%s: XDG_RUNTIME_DIR not set; "
+               "please give a socket name to --listen\n", this_pgmname);
+      errno = ENOENT;
+      return NULL;
+    }
+
+  n = strlen ("S.") + strlen (this_pgmname) + 1;
+  base = malloc (n);
+  if (!base)
+    return NULL;
+  snprintf (base, n, "S.%s", this_pgmname);
+  name = private_file_name (base);
+  free (base);
+  return name;
+}
+
+
+/* Create, bind and listen on the Unix domain socket NAME.  Returns
+   the file descriptor or -1 on error.  */
+static int
+create_listen_socket (const char *name)
+{
+  struct sockaddr_un addr;
+  mode_t oldmask;
+  int fd;
+  int rc;
+
+  if (strlen (name) >= sizeof addr.sun_path)
+    {
+      fprintf (stderr, "%s: socket name '%s' is too long\n",
+               this_pgmname, name);
+      return -1;
+    }
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, name);
+
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    {
+      fprintf (stderr, "%s: can't create socket: %s\n",
+               this_pgmname, strerror (errno));
+      return -1;
+    }
+
+  oldmask = umask (077);
+  rc = bind (fd, (struct sockaddr *)&addr, sizeof addr);
+  if (rc == -1 && errno == EADDRINUSE)
+    {
+      /* Remove a stale socket but do not hijack the socket of a
+         running pinentry.  */
+      int probe = socket (AF_UNIX, SOCK_STREAM, 0);
+
+      if (probe != -1
+          && connect (probe, (struct sockaddr *)&addr, sizeof addr) == -1
+          && errno == ECONNREFUSED)
+        {
+          remove (name);
+          rc = bind (fd, (struct sockaddr *)&addr, sizeof addr);
+        }
+      else
+        errno = EADDRINUSE;
+      if (probe != -1)
+        close (probe);
+    }
+  umask (oldmask);
+  if (rc == -1)
+    {
+      fprintf (stderr, "%s: error binding socket to '%s': %s\n",
+               this_pgmname, name, strerror (errno));
+      close (fd);
+      return -1;
+    }
+
+  if (listen (fd, 5) == -1)
+    {
+      fprintf (stderr, "%s: listen() failed: %s\n",
+               this_pgmname, strerror (errno));
+      close (fd);
+      remove (name);
+      return -1;
+    }
+
+  return fd;
+}
+
+
+/* Serve one connection on the accepted socket FD.  */
+static void
+serve_socket_connection (int fd)
+{
+  gpg_error_t rc;
+  assuan_context_t ctx;
+  assuan_peercred_t peercred;
+  pinentry_cmd_handler_t cmd_handler;
+
+  rc = new_assuan_context (&ctx);
   if (rc)
     {
-      fprintf (stderr, "%s: failed to the register commands with Assuan: %s\n",
+      fprintf (stderr, "server context creation failed: %s\n",
+	       gpg_strerror (rc));
+      close (fd);
+      return;
+    }
+
+  rc = assuan_init_socket_server (ctx, assuan_fdopen (fd),
+                                  ASSUAN_SOCKET_SERVER_ACCEPTED);
+  if (rc)
+    {
+      fprintf (stderr, "%s: failed to initialize the server: %s\n",
                this_pgmname, gpg_strerror (rc));
+      assuan_release (ctx);
+      close (fd);
+      return;
+    }
+
+  /* The socket directory is private but we better double check that
+     only our own user talks to us.  */
+  if (assuan_get_peercred (ctx, &peercred)
+      || peercred->uid != getuid ())
+    {
+      fprintf (stderr, "%s: rejecting connection from foreign user\n",
+               this_pgmname);
+      assuan_release (ctx);
+      return;
+    }
+
+  /* Each connection gets a fresh session so that no prompt texts or
+     options of a client leak into the next connection.  The command
+     handler is global because OPTION allow-emacs-prompt swaps it, so
+     restore it as well.  */
+  cmd_handler = pinentry_cmd_handler;
+  if (!setup_server (ctx))
+    serve_connection (ctx);
+
+  release_server (ctx);
+  pinentry_cmd_handler = cmd_handler;
+}
+
+
+/* Run as a daemon: accept connections on a Unix domain socket and
+   serve them one after the other using the same command table as
+   the pipe server.  This saves the cost of starting the toolkit for
+   each request.  */
+static int
+pinentry_listen_loop (void)
+{
+  char *name;
+  int listen_fd;
+  int fd;
+  struct sigaction sa;
+
+  /* Extra check to make sure we have dropped privs. */
+  if (getuid() != geteuid())
+    abort ();
+
+  if (listen_socket_name)
+    name = strdup (listen_socket_name);
+  else
+    name = default_listen_socket_name ();
+  if (!name)
+    {
+      fprintf (stderr, "%s: can't get socket name: %s\n",
+               this_pgmname, strerror (errno));
       return -1;
     }
 
-  assuan_register_option_handler (ctx, option_handler);
-#if 0
-  assuan_set_log_stream (ctx, stderr);
-#endif
-  assuan_register_reset_notify (ctx, pinentry_assuan_reset_handler);
+  listen_fd = create_listen_socket (name);
+  if (listen_fd == -1)
+    {
+      free (name);
+      return -1;
+    }
+  listen_socket_in_use = name;
+  atexit (remove_listen_socket);
+
+  /* atexit handlers do not run when we are killed, which is how a
+     daemon is usually stopped.  */
+  memset (&sa, 0, sizeof sa);
+  sa.sa_handler = listen_term_handler;
+  sigemptyset (&sa.sa_mask);
+  sigaction (SIGTERM, &sa, NULL);
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGHUP, &sa, NULL);
+
+  /* A client going away while we write to it must not terminate the
+     server.  */
+  signal (SIGPIPE, SIG_IGN);
+
+  if (pinentry_defaults.debug)
+    fprintf (stderr, "%s: listening on socket '%s'\n", this_pgmname, name);
 
   for (;;)
     {
-      rc = assuan_accept (ctx);
-      if (rc == -1)
-          break;
-      else if (rc)
+      fd = accept (listen_fd, NULL, NULL);
+      if (fd == -1)
         {
-          fprintf (stderr, "%s: Assuan accept problem: %s\n",
-                   this_pgmname, gpg_strerror (rc));
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          fprintf (stderr, "%s: accept() failed: %s\n",
+                   this_pgmname, strerror (errno));
           break;
         }
 
-      rc = assuan_process (ctx);
-      if (rc)
-        {
-          fprintf (stderr, "%s: Assuan processing failed: %s\n",
-                   this_pgmname, gpg_strerror (rc));
-          continue;
-        }
+      serve_socket_connection (fd);
     }
 
-  assuan_release (ctx);
-  return 0;
+  close (listen_fd);
+  return -1;
 }
+#endif /*!HAVE_W32_SYSTEM*/
 
 
 /* Start the pinentry event loop.  The program will start to process
@@ -2073,5 +3565,16 @@ pinentry_loop2 (int infd, int outfd)
 int
 pinentry_loop (void)
 {
+  if (listen_mode)
+    {
+#ifdef HAVE_W32_SYSTEM
+      fprintf (stderr, "%s: option --listen is not supported\n",
+               this_pgmname);
+      return -1;
+#else
+      return pinentry_listen_loop ();
+#endif
+    }
+
   return pinentry_loop2 (STDIN_FILENO, STDOUT_FILENO);
 }
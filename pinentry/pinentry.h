@@ -38,6 +38,14 @@ typedef enum {
   PINENTRY_COLOR_CYAN, PINENTRY_COLOR_WHITE
 } pinentry_color_t;
 
+/* The ways to determine the quality of a passphrase.  */
+typedef enum {
+  PINENTRY_QUALITY_AGENT,   /* Ask the caller with INQUIRE QUALITY.  */
+  PINENTRY_QUALITY_LOCAL,   /* Only use the built-in estimator.  */
+  PINENTRY_QUALITY_HYBRID   /* Show the estimate until the caller's
+                               answer arrives.  */
+} pinentry_quality_mode_t;
+
 struct pinentry
 {
   /* The window title, or NULL.  (Assuan: "SETTITLE TITLE".)  */
@@ -183,6 +191,10 @@ struct pinentry
      (Assuan: "SETQUALITYBAR_TT TOOLTIP".)  */
   char *quality_bar_tt;
 
+  /* How the quality shown in the quality bar is determined.
+     (Assuan: "OPTION quality-mode=agent|local|hybrid".)  */
+  pinentry_quality_mode_t quality_mode;
+
   /* If this is not NULL, a generate action should be shown.
      There will be an inquiry back to the caller to get such a
      PIN. generate action.  Malloced or NULL.
@@ -316,6 +328,26 @@ char *pinentry_get_title (pinentry_t pe);
 int pinentry_inq_quality (pinentry_t pin,
                           const char *passphrase, size_t length);
 
+/* Store the locally estimated quality of PASSPHRASE of LENGTH at
+   R_VALUE and return true if the estimate shall be shown according
+   to the quality mode of PIN.  */
+int pinentry_quality_estimate (pinentry_t pin,
+                               const char *passphrase, size_t length,
+                               int *r_value);
+
+/* Start an asynchronous quality inquiry for PASSPHRASE of LENGTH and
+   store the descriptor to watch for the response at R_FD.  Returns a
+   handle for the request or 0 if this is not possible.  Requests
+   superseded by a newer one are dropped.  */
+int pinentry_inq_quality_submit (pinentry_t pin,
+                                 const char *passphrase, size_t length,
+                                 int *r_fd);
+
+/* Return the handle of the request for which a quality result has
+   been received and store the value at R_VALUE.  Returns 0 if there
+   is no new result.  */
+int pinentry_inq_quality_collect (pinentry_t pin, int *r_value);
+
 /* Run a checkpin inquiry for PASSPHRASE of LENGTH.  Returns NULL, if the
    passphrase satisfies the constraints.  Otherwise, returns a malloced error
    string. */
@@ -325,6 +357,38 @@ char *pinentry_inq_checkpin (pinentry_t pin,
 /* Run a genpin iquriry. Returns a malloced string or NULL */
 char *pinentry_inq_genpin (pinentry_t pin);
 
+/* The flags returned by pinentry_process_input.  */
+#define PINENTRY_LIVE_ERROR   1  /* The error message has been changed.  */
+#define PINENTRY_LIVE_TIMEOUT 2  /* The timeout has been changed.  */
+#define PINENTRY_LIVE_CANCEL  4  /* The dialog shall be canceled.  */
+#define PINENTRY_LIVE_QUALITY 8  /* A quality result is available.  */
+
+/* Return the file descriptor to watch for commands arriving while
+   the dialog for PIN is open, or -1 if not available.  */
+int pinentry_get_input_fd (pinentry_t pin);
+
+/* Process the commands which arrived on the file descriptor returned
+   by pinentry_get_input_fd.  Returns a set of PINENTRY_LIVE_*
+   flags.  */
+int pinentry_process_input (pinentry_t pin);
+
+/* Return true if commands are waiting to be processed with
+   pinentry_process_input, either in a buffer or on the file
+   descriptor.  */
+int pinentry_input_pending (pinentry_t pin);
+
+/* Tell the core that the user provided input to the dialog for PIN.
+   Frontends call this on each keystroke; it is cheap.  */
+void pinentry_note_input (pinentry_t pin);
+
+/* Record the begin and the end of the span NAME, or an instant event
+   NAME, in the timeline written with --trace.  NAME must be a string
+   literal.  Frontends use this to trace the construction of the
+   toolkit and of the dialog.  */
+void pinentry_trace_begin (const char *name);
+void pinentry_trace_end (const char *name);
+void pinentry_trace_mark (const char *name);
+
 /* Try to make room for at least LEN bytes for the pin in the pinentry
    PIN.  Returns new buffer on success and 0 on failure.  */
 char *pinentry_setbufferlen (pinentry_t pin, int len);
@@ -350,6 +414,23 @@ void pinentry_parse_opts (int argc, char *argv[]);
 /* Set the optional flag used with getinfo. */
 void pinentry_set_flavor_flag (const char *string);
 
+/* The features of a frontend returned by GETINFO features.  */
+#define PINENTRY_FEATURE_QUALITY_BAR    1  /* SETQUALITYBAR.  */
+#define PINENTRY_FEATURE_GENPIN         2  /* SETGENPIN.  */
+#define PINENTRY_FEATURE_FORMATTED      4  /* OPTION formatted-passphrase.  */
+#define PINENTRY_FEATURE_CONSTRAINTS    8  /* OPTION constraints-*.  */
+#define PINENTRY_FEATURE_EXTERNAL_CACHE 16 /* OPTION allow-external-
+                                              password-cache.  */
+#define PINENTRY_FEATURE_ASYNC_QUALITY  32 /* Quality inquiries do not
+                                              block the dialog.  */
+#define PINENTRY_FEATURE_LIVE_UPDATES   64 /* Commands while a dialog
+                                              is open.  */
+
+/* Set the features of the frontend, a combination of the
+   PINENTRY_FEATURE_ values.  A frontend which falls back to curses
+   must set PINENTRY_CURSES_FEATURES instead.  */
+void pinentry_set_features (unsigned int features);
+
 
 
 /* The caller must define this variable to process assuan commands.  */
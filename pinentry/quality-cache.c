@@ -0,0 +1,230 @@
+/* quality-cache.c - Cache for passphrase quality results.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* The quality cache remembers the answers to INQUIRE QUALITY while a
+   passphrase is entered so that typing, deleting and retyping the
+   same text does not ask the caller again.  The entries are indexed
+   by a SipHash-2-4 of the escaped inquiry line with a random key;
+   neither the passphrase nor a plain hash of it is stored.  The whole
+   cache lives in secure memory and is wiped when it is released.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "secmem-util.h"
+#include "quality-cache.h"
+#include "../secmem/secmem.h"
+
+/* The number of entries; must be a power of 2.  */
+#define CACHE_SIZE 128
+
+struct quality_cache_s
+{
+  /* The SipHash key.  */
+  uint64_t k0, k1;
+
+  /* The cached results indexed by the low bits of the hash.  A slot
+     is used if its HASH is not 0.  */
+  struct
+  {
+    uint64_t hash;
+    int value;
+  } entries[CACHE_SIZE];
+};
+
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                \
+  do                                                            \
+    {                                                           \
+      v0 += v1; v1 = ROTL (v1, 13); v1 ^= v0; v0 = ROTL (v0, 32); \
+      v2 += v3; v3 = ROTL (v3, 16); v3 ^= v2;                   \
+      v0 += v3; v3 = ROTL (v3, 21); v3 ^= v0;                   \
+      v2 += v1; v1 = ROTL (v1, 17); v1 ^= v2; v2 = ROTL (v2, 32); \
+    }                                                           \
+  while (0)
+
+
+/* Return the little endian 64 bit value at P.  */
+static uint64_t
+get_le64 (const unsigned char *p)
+{
+  return ((uint64_t)p[0]       | ((uint64_t)p[1] << 8)
+          | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+          | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40)
+          | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56));
+}
+
+
+/* Compute SipHash-2-4 with the key K0,K1 over BUFFER of LENGTH.  */
+static uint64_t
+siphash (uint64_t k0, uint64_t k1, const unsigned char *buffer, size_t length)
+{
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+  uint64_t b = (uint64_t)length << 56;
+  uint64_t m;
+  size_t left = length & 7;
+  const unsigned char *end = buffer + length - left;
+
+  for (; buffer != end; buffer += 8)
+    {
+      m = get_le64 (buffer);
+      v3 ^= m;
+      SIPROUND;
+      SIPROUND;
+      v0 ^= m;
+    }
+
+  switch (left)
+    {
+    case 7: b |= (uint64_t)buffer[6] << 48; /* fall through */
+    case 6: b |= (uint64_t)buffer[5] << 40; /* fall through */
+    case 5: b |= (uint64_t)buffer[4] << 32; /* fall through */
+    case 4: b |= (uint64_t)buffer[3] << 24; /* fall through */
+    case 3: b |= (uint64_t)buffer[2] << 16; /* fall through */
+    case 2: b |= (uint64_t)buffer[1] << 8;  /* fall through */
+    case 1: b |= (uint64_t)buffer[0];       /* fall through */
+    default: break;
+    }
+
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+
+  m = v0 ^ v1 ^ v2 ^ v3;
+  v0 = v1 = v2 = v3 = b = 0;
+  return m;
+}
+
+
+/* Fill BUFFER of LENGTH with random bytes.  The key only needs to be
+   unpredictable to whoever sends the passphrases, thus a weak
+   fallback is acceptable if there is no system RNG.  */
+static void
+get_random_key (unsigned char *buffer, size_t length)
+{
+  FILE *fp;
+  size_t n = 0;
+  uint64_t seed;
+  size_t i;
+
+  fp = fopen ("/dev/urandom", "rb");
+  if (fp)
+    {
+      setvbuf (fp, NULL, _IONBF, 0);
+      n = fread (buffer, 1, length, fp);
+      fclose (fp);
+    }
+  if (n == length)
+    return;
+
+  seed = ((uint64_t)time (NULL) << 20) ^ (uint64_t)getpid ()
+    ^ (uint64_t)(size_t)buffer ^ (uint64_t)clock ();
+  for (i = 0; i < length; i++)
+    {
+      seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+      buffer[i] ^= (unsigned char)(seed >> 56);
+    }
+}
+
+
+/* Create a new, empty quality cache in secure memory.  Returns NULL
+   if out of secure memory.  */
+quality_cache_t
+quality_cache_new (void)
+{
+  quality_cache_t cache;
+  unsigned char key[16];
+
+  cache = secmem_malloc (sizeof *cache);
+  if (!cache)
+    return NULL;
+  memset (cache, 0, sizeof *cache);
+
+  get_random_key (key, sizeof key);
+  cache->k0 = get_le64 (key);
+  cache->k1 = get_le64 (key + 8);
+  wipememory (key, sizeof key);
+
+  return cache;
+}
+
+
+/* Release CACHE.  This wipes the key and all entries.  */
+void
+quality_cache_release (quality_cache_t cache)
+{
+  secmem_free (cache);
+}
+
+
+/* Return the hash of STRING to be used with quality_cache_get and
+   quality_cache_put.  The hash is never 0.  */
+uint64_t
+quality_cache_hash (quality_cache_t cache, const char *string)
+{
+  uint64_t hash;
+
+  hash = siphash (cache->k0, cache->k1,
+                  (const unsigned char *)string, strlen (string));
+  return hash ? hash : 1;
+}
+
+
+/* Store the cached value for HASH at R_VALUE and return true, or
+   return false if there is no such value.  */
+int
+quality_cache_get (quality_cache_t cache, uint64_t hash, int *r_value)
+{
+  unsigned int idx = (unsigned int)hash & (CACHE_SIZE - 1);
+
+  if (cache->entries[idx].hash != hash)
+    return 0;
+  *r_value = cache->entries[idx].value;
+  return 1;
+}
+
+
+/* Remember VALUE for HASH.  This may evict an older entry.  */
+void
+quality_cache_put (quality_cache_t cache, uint64_t hash, int value)
+{
+  unsigned int idx = (unsigned int)hash & (CACHE_SIZE - 1);
+
+  cache->entries[idx].hash = hash;
+  cache->entries[idx].value = value;
+}
@@ -0,0 +1,38 @@
+/* quality-cache.h - Cache for passphrase quality results.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef QUALITY_CACHE_H
+#define QUALITY_CACHE_H
+
+#include <stdint.h>
+
+typedef struct quality_cache_s *quality_cache_t;
+
+quality_cache_t quality_cache_new (void);
+
+void quality_cache_release (quality_cache_t cache);
+
+uint64_t quality_cache_hash (quality_cache_t cache, const char *string);
+
+int quality_cache_get (quality_cache_t cache, uint64_t hash, int *r_value);
+
+void quality_cache_put (quality_cache_t cache, uint64_t hash, int value);
+
+#endif
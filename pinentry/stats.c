@@ -0,0 +1,142 @@
+/* stats.c - Latency statistics.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* The latencies of the interesting operations are collected in
+   histograms with fixed buckets for the life time of the process.
+   They can be retrieved with "GETINFO stats".  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <time.h>
+#ifdef HAVE_W32_SYSTEM
+# include <windows.h>
+#else
+# include <sys/time.h>
+#endif
+
+#include "stats.h"
+
+#define DIM(v) (sizeof (v) / sizeof ((v)[0]))
+
+/* The upper bounds of the buckets in microseconds.  The last bucket
+   takes everything above.  */
+static const uint64_t bucket_limits[] =
+  {
+    100, 1000, 10000, 100000, 1000000, 10000000, 60000000
+  };
+
+#define N_BUCKETS (DIM (bucket_limits) + 1)
+
+static const char *const stats_names[STATS_LAST] =
+  {
+    "getpin", "confirm", "handler", "first-input",
+    "inq-quality", "inq-checkpin", "inq-genpin",
+    "cache-lookup", "cache-save"
+  };
+
+static struct
+{
+  unsigned long count;
+  uint64_t sum;
+  uint64_t max;
+  unsigned long buckets[N_BUCKETS];
+} histograms[STATS_LAST];
+
+
+/* Return the time of a monotonic clock in microseconds.  */
+uint64_t
+stats_now (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return (uint64_t)GetTickCount64 () * 1000;
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  return 0;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
+/* Record the time since START, which was returned by stats_now, for
+   the operation ID.  */
+void
+stats_record (stats_id_t id, uint64_t start)
+{
+  uint64_t now = stats_now ();
+  uint64_t elapsed = now > start ? now - start : 0;
+  int i;
+
+  if ((unsigned int)id >= STATS_LAST)
+    return;
+
+  for (i = 0; i < DIM (bucket_limits); i++)
+    if (elapsed < bucket_limits[i])
+      break;
+
+  histograms[id].count++;
+  histograms[id].sum += elapsed;
+  if (elapsed > histograms[id].max)
+    histograms[id].max = elapsed;
+  histograms[id].buckets[i]++;
+}
+
+
+/* Write the histogram for ID as a line to BUFFER of SIZE.  The line
+   has the name, the count, the sum and the maximum in microseconds,
+   and the counts of the buckets.  Returns the length of the line or
+   -1 if it did not fit.  */
+int
+stats_format (stats_id_t id, char *buffer, size_t size)
+{
+  size_t n;
+  int rc;
+  int i;
+
+  if ((unsigned int)id >= STATS_LAST)
+    return -1;
+
+  rc = snprintf (buffer, size, "%s %lu %llu %llu",
+                 stats_names[id], histograms[id].count,
+                 (unsigned long long)histograms[id].sum,
+                 (unsigned long long)histograms[id].max);
+  if (rc < 0 || rc >= size)
+    return -1;
+  n = rc;
+
+  for (i = 0; i < N_BUCKETS; i++)
+    {
+      rc = snprintf (buffer + n, size - n, " %lu", histograms[id].buckets[i]);
+      if (rc < 0 || rc >= size - n)
+        return -1;
+      n += rc;
+    }
+
+  return n;
+}
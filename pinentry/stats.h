@@ -0,0 +1,49 @@
+/* stats.h - Latency statistics.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The operations for which the latency is recorded.  */
+typedef enum
+  {
+    STATS_GETPIN,         /* The GETPIN command.  */
+    STATS_CONFIRM,        /* The CONFIRM and MESSAGE commands.  */
+    STATS_HANDLER,        /* The frontend's command handler.  */
+    STATS_FIRST_INPUT,    /* From the start of the handler to the
+                             first input of the user.  */
+    STATS_INQ_QUALITY,    /* INQUIRE QUALITY.  */
+    STATS_INQ_CHECKPIN,   /* INQUIRE CHECKPIN.  */
+    STATS_INQ_GENPIN,     /* INQUIRE GENPIN.  */
+    STATS_CACHE_LOOKUP,   /* password_cache_lookup.  */
+    STATS_CACHE_SAVE,     /* password_cache_save.  */
+    STATS_LAST
+  } stats_id_t;
+
+uint64_t stats_now (void);
+
+void stats_record (stats_id_t id, uint64_t start);
+
+int stats_format (stats_id_t id, char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,111 @@
+/* t-passphrase-quality.c - Test for the passphrase quality estimator.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* The estimator is included so that its fixed point logarithm can be
+   checked directly.  The expected values are the same on all
+   platforms, whatever the size of a long.  */
+#include "passphrase-quality.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int errors;
+
+#define fail(...) do { fprintf (stderr, __VA_ARGS__); errors++; } while (0)
+
+
+/* Check log2_bits for the sizes of all possible character pools.
+   The values are floor (16 * log2 (N)).  */
+static void
+check_log2_bits (void)
+{
+  static const struct { unsigned int n, bits; } tests[] =
+    {
+      { 0, 0 }, { 1, 0 }, { 2, 16 }, { 10, 53 }, { 26, 75 }, { 33, 80 },
+      { 36, 82 }, { 52, 91 }, { 59, 94 }, { 62, 95 }, { 69, 97 },
+      { 85, 102 }, { 95, 105 }, { 100, 106 }, { 195, 121 }
+    };
+  size_t i;
+  unsigned int bits;
+
+  for (i = 0; i < sizeof tests / sizeof *tests; i++)
+    {
+      bits = log2_bits (tests[i].n);
+      if (bits != tests[i].bits)
+        fail ("log2_bits (%u) = %u, expected %u\n",
+              tests[i].n, bits, tests[i].bits);
+    }
+}
+
+
+/* Check that common passwords and simple patterns score low.  */
+static void
+check_weak (void)
+{
+  static const char *const tests[] =
+    {
+      "", "password", "P4$$w0rd", "123456", "987654321", "qwerty123",
+      "aaaaaaaaaaaa", "abcdefgh", "asdfghjkl", "Passw0rd!", "letmein1",
+      "iloveyou"
+    };
+  size_t i;
+  int score;
+
+  for (i = 0; i < sizeof tests / sizeof *tests; i++)
+    {
+      score = passphrase_quality_estimate (tests[i], strlen (tests[i]));
+      if (score > 30)
+        fail ("'%s' scores %d, expected at most 30\n", tests[i], score);
+    }
+}
+
+
+/* Check that random passphrases of 16 printable characters score
+   high.  */
+static void
+check_random (void)
+{
+  char buffer[17];
+  unsigned long seed = 42;
+  int i, j, score;
+
+  for (i = 0; i < 1000; i++)
+    {
+      for (j = 0; j < 16; j++)
+        {
+          seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+          buffer[j] = ' ' + (seed >> 16) % 95;
+        }
+      buffer[16] = 0;
+      score = passphrase_quality_estimate (buffer, 16);
+      if (score < 80)
+        fail ("'%s' scores %d, expected at least 80\n", buffer, score);
+    }
+}
+
+
+int
+main (void)
+{
+  check_log2_bits ();
+  check_weak ();
+  check_random ();
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/* trace.c - Timeline tracing.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* The events of the life time of the process are collected in a
+   fixed size buffer.  If a trace file has been set, they are written
+   to it at exit in the Trace Event Format understood by Perfetto and
+   chrome://tracing.  Recording is always on, so that the events
+   before the trace file is known (e.g. from pinentry_init or before
+   OPTION trace) are not lost.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_W32_SYSTEM
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+#include "stats.h"
+#include "trace.h"
+
+/* The maximum number of events.  Further events are dropped.  */
+#define MAX_EVENTS 4096
+
+struct trace_event_s
+{
+  const char *name;  /* A string literal.  */
+  uint64_t ts;       /* The time in microseconds.  */
+  uint64_t dur;      /* The duration for complete events.  */
+  char phase;        /* 'B', 'E', 'i' or 'X'.  */
+};
+
+static struct trace_event_s events[MAX_EVENTS];
+static unsigned int n_events;
+static unsigned long n_dropped;
+
+static char *trace_file;
+
+
+/* Add an event with PHASE and NAME at TS lasting DUR.  */
+static void
+add_event (int phase, const char *name, uint64_t ts, uint64_t dur)
+{
+  if (n_events >= MAX_EVENTS)
+    {
+      n_dropped++;
+      return;
+    }
+
+  events[n_events].name = name;
+  events[n_events].ts = ts;
+  events[n_events].dur = dur;
+  events[n_events].phase = phase;
+  n_events++;
+}
+
+
+/* Record an event with PHASE, which is 'B' for the begin of a span,
+   'E' for its end and 'i' for an instant event.  NAME must be a
+   string literal without characters which need escaping in JSON.  */
+void
+trace_event (int phase, const char *name)
+{
+  add_event (phase, name, stats_now (), 0);
+}
+
+
+/* Record a span NAME from START, which was returned by stats_now, to
+   now.  This is used for spans which do not nest, like an inquiry
+   which is answered while the dialog is processing input.  */
+void
+trace_complete (const char *name, uint64_t start)
+{
+  uint64_t now = stats_now ();
+
+  add_event ('X', name, start, now > start ? now - start : 0);
+}
+
+
+static void
+write_trace (void)
+{
+  FILE *fp;
+  unsigned long pid;
+  unsigned int i;
+
+  if (!trace_file)
+    return;
+
+  fp = fopen (trace_file, "w");
+  if (!fp)
+    return;
+
+#ifdef HAVE_W32_SYSTEM
+  pid = GetCurrentProcessId ();
+#else
+  pid = getpid ();
+#endif
+
+  fputs ("{\"traceEvents\":[\n", fp);
+  for (i = 0; i < n_events; i++)
+    {
+      fprintf (fp, "{\"name\":\"%s\",\"cat\":\"pinentry\",\"ph\":\"%c\","
+               "\"ts\":%llu,", events[i].name, events[i].phase,
+               (unsigned long long)events[i].ts);
+      if (events[i].phase == 'X')
+        fprintf (fp, "\"dur\":%llu,", (unsigned long long)events[i].dur);
+      else if (events[i].phase == 'i')
+        fputs ("\"s\":\"t\",", fp);
+      fprintf (fp, "\"pid\":%lu,\"tid\":1},\n", pid);
+    }
+  fprintf (fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,"
+           "\"tid\":1,\"args\":{\"name\":\"pinentry\"}}\n", pid);
+  fprintf (fp, "],\"displayTimeUnit\":\"ms\","
+           "\"otherData\":{\"dropped\":\"%lu\"}}\n", n_dropped);
+  fclose (fp);
+}
+
+
+/* Write the trace to FILENAME at exit.  A later call replaces the
+   file name.  Returns 0 on success or -1 with ERRNO set.  */
+int
+trace_set_file (const char *filename)
+{
+  static int registered;
+  char *copy;
+
+  copy = strdup (filename);
+  if (!copy)
+    return -1;
+
+  if (!registered)
+    {
+      if (atexit (write_trace))
+        {
+          free (copy);
+          errno = ENOMEM;
+          return -1;
+        }
+      registered = 1;
+    }
+
+  free (trace_file);
+  trace_file = copy;
+  return 0;
+}
@@ -0,0 +1,133 @@
+/* bench-pinlineedit.cpp - Benchmark for the formatted passphrase.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program pastes passphrases of a few kilobytes into a
+ * PinLineEdit showing a formatted passphrase, then types and deletes
+ * characters in the middle of them, and reports the cost of each.  It
+ * uses the offscreen platform unless QT_QPA_PLATFORM is set.  It is
+ * not built by default; use "make bench-pinlineedit" to build it.
+ */
+
+#include "pinlineedit.h"
+
+#include <QApplication>
+#include <QClipboard>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QKeyEvent>
+#include <QString>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const int Keystrokes = 200;
+
+static QString randomPassphrase(int size)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    QString text;
+    text.reserve(size);
+    for (int i = 0; i < size; i++) {
+        text.append(QLatin1Char(chars[rand() % (sizeof chars - 1)]));
+    }
+    return text;
+}
+
+static void sendKey(PinLineEdit *edit, int key, const QString &text)
+{
+    QKeyEvent press{QEvent::KeyPress, key, Qt::NoModifier, text};
+    QCoreApplication::sendEvent(edit, &press);
+    QKeyEvent release{QEvent::KeyRelease, key, Qt::NoModifier, text};
+    QCoreApplication::sendEvent(edit, &release);
+}
+
+static double usecs(const QElapsedTimer &timer, int count)
+{
+    return timer.nsecsElapsed() / 1000.0 / count;
+}
+
+static bool bench(int size)
+{
+    const QString passphrase = randomPassphrase(size);
+    PinLineEdit edit;
+    QElapsedTimer timer;
+
+    // The default of 32767 characters is too small for the largest
+    // passphrases with their separators.
+    edit.setMaxLength(2 * (size + Keystrokes));
+    edit.setFormattedPassphrase(true);
+    QGuiApplication::clipboard()->setText(passphrase);
+
+    timer.start();
+    edit.paste();
+    const double paste = usecs(timer, 1);
+    if (edit.pin() != passphrase) {
+        fprintf(stderr, "bench-pinlineedit: paste of %d characters is wrong\n", size);
+        return false;
+    }
+
+    edit.setCursorPosition(edit.cursorPosition() / 2);
+    timer.start();
+    for (int i = 0; i < Keystrokes; i++) {
+        sendKey(&edit, Qt::Key_X, QStringLiteral("x"));
+    }
+    const double type = usecs(timer, Keystrokes);
+
+    timer.start();
+    for (int i = 0; i < Keystrokes; i++) {
+        sendKey(&edit, Qt::Key_Backspace, QString());
+    }
+    const double erase = usecs(timer, Keystrokes);
+    if (edit.pin() != passphrase) {
+        fprintf(stderr, "bench-pinlineedit: editing %d characters is wrong\n", size);
+        return false;
+    }
+
+    timer.start();
+    for (int i = 0; i < Keystrokes; i++) {
+        edit.end(false);
+        sendKey(&edit, Qt::Key_X, QStringLiteral("x"));
+    }
+    const double append = usecs(timer, Keystrokes);
+
+    printf("%6d chars: paste %10.1f us, type %8.1f us, backspace %8.1f us,"
+           " append %8.1f us\n", size, paste, type, erase, append);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app{argc, argv};
+    bool okay = true;
+
+    srand(42);
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            okay &= bench(atoi(argv[i]));
+        }
+    } else {
+        for (int size : {64, 1024, 4096, 16384, 65536}) {
+            okay &= bench(size);
+        }
+    }
+
+    return okay ? 0 : 1;
+}
@@ -231,6 +231,7 @@ qt_cmd_handler(pinentry_t pe)
         QStringLiteral("Save passphrase in password manager");
 
     if (want_pass) {
+        pinentry_trace_begin("create-dialog");
         PinEntryDialog pinentry(pe, nullptr, 0, true,
                                 repeatString, visibilityTT, hideTT);
         if (qApp->platformName() == QStringLiteral("wayland")) {
@@ -274,6 +275,7 @@ qt_cmd_handler(pinentry_t pe)
         if (pe->quality_bar_tt) {
             pinentry.setQualityBarTT(from_utf8(pe->quality_bar_tt));
         }
+        pinentry_trace_end("create-dialog");
         bool ret = pinentry.exec();
         if (!ret) {
             if (pinentry.timedOut())
@@ -281,21 +283,20 @@ qt_cmd_handler(pinentry_t pe)
             return -1;
         }
 
-        const QString pinStr = pinentry.pin();
-        QByteArray pin = pinStr.toUtf8();
-
         if (!!pe->repeat_passphrase) {
             /* Should not have been possible to accept
                the dialog in that case but we do a safety
                check here */
-            pe->repeat_okay = (pinStr == pinentry.repeatedPin());
+            pe->repeat_okay = pinentry.repeatedPinMatches();
         }
 
-        int len = strlen(pin.constData());
+        /* The passphrase goes straight from the dialog into the
+           secure buffer.  */
+        int len = pinentry.pinUtf8Length();
         if (len >= 0) {
             pinentry_setbufferlen(pe, len + 1);
             if (pe->pin) {
-                strcpy(pe->pin, pin.constData());
+                pinentry.pinToUtf8(pe->pin);
                 return len;
             }
         }
@@ -309,10 +310,12 @@ qt_cmd_handler(pinentry_t pe)
             pe->notok      ? QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel :
             /* else */       QMessageBox::Ok | QMessageBox::Cancel ;
 
+        pinentry_trace_begin("create-dialog");
         PinentryConfirm box{QMessageBox::Information, title, desc, buttons};
         box.setTextFormat(Qt::PlainText);
         box.setTextInteractionFlags(Qt::TextSelectableByMouse);
         box.setTimeout(std::chrono::seconds{pe->timeout});
+        box.watchInput(pe);
         if (qApp->platformName() == QStringLiteral("wayland")) {
             setup_foreground_window(&box, QUrl::fromPercentEncoding(qgetenv("PINENTRY_GEOM_HINT").split(' ')[0]));
         } else {
@@ -342,6 +345,7 @@ qt_cmd_handler(pinentry_t pe)
             box.setDefaultButton(QMessageBox::Cancel);
         }
 
+        pinentry_trace_end("create-dialog");
         box.show();
         raiseWindow(&box);
 
@@ -379,6 +383,13 @@ int
 main(int argc, char *argv[])
 {
     pinentry_init("pinentry-qt");
+    pinentry_set_features(PINENTRY_FEATURE_QUALITY_BAR
+                          | PINENTRY_FEATURE_GENPIN
+                          | PINENTRY_FEATURE_FORMATTED
+                          | PINENTRY_FEATURE_CONSTRAINTS
+                          | PINENTRY_FEATURE_EXTERNAL_CACHE
+                          | PINENTRY_FEATURE_ASYNC_QUALITY
+                          | PINENTRY_FEATURE_LIVE_UPDATES);
 
     QApplication *app = NULL;
     int new_argc = 0;
@@ -402,6 +413,7 @@ main(int argc, char *argv[])
     if (!isGUISession) {
         pinentry_cmd_handler = curses_cmd_handler;
         pinentry_set_flavor_flag ("curses");
+        pinentry_set_features(PINENTRY_CURSES_FEATURES);
     } else
 #endif
     {
@@ -444,10 +456,12 @@ main(int argc, char *argv[])
          */
         new_argc = argc;
         Q_ASSERT (new_argc);
+        pinentry_trace_begin("qapplication");
         app = new QApplication(new_argc, new_argv);
         app->setWindowIcon(QIcon(QLatin1String(":/icons/pinentry.png")));
         app->setDesktopFileName(QStringLiteral("org.gnupg.pinentry-qt"));
         (void) new KeyboardFocusIndication{app};
+        pinentry_trace_end("qapplication");
     }
 
     pinentry_parse_opts(argc, argv);
@@ -31,6 +31,7 @@
 #include <QLabel>
 #include <QSpacerItem>
 #include <QFontMetrics>
+#include <QSocketNotifier>
 
 namespace
 {
@@ -88,6 +89,43 @@ bool PinentryConfirm::timedOut() const
     return _timed_out;
 }
 
+void PinentryConfirm::watchInput(pinentry_t pe)
+{
+    const int liveFd = pinentry_get_input_fd(pe);
+    if (liveFd == -1) {
+        return;
+    }
+    _pinentry_info = pe;
+    _liveNotifier = new QSocketNotifier(liveFd, QSocketNotifier::Read, this);
+    connect(_liveNotifier, &QSocketNotifier::activated,
+            this, &PinentryConfirm::processLiveInput);
+    /* Commands sent right behind CONFIRM may already be buffered.  */
+    if (pinentry_input_pending(pe)) {
+        QTimer::singleShot(0, this, &PinentryConfirm::processLiveInput);
+    }
+}
+
+/* A SETERROR is consumed but has nothing to show in a message box.  */
+void PinentryConfirm::processLiveInput()
+{
+    const int flags = pinentry_process_input(_pinentry_info);
+
+    if (flags & PINENTRY_LIVE_CANCEL) {
+        _liveNotifier->setEnabled(false);
+        done(QMessageBox::Cancel);
+        return;
+    }
+    if (flags & PINENTRY_LIVE_TIMEOUT) {
+        setTimeout(std::chrono::seconds{_pinentry_info->timeout});
+        if (_pinentry_info->timeout > 0) {
+            _timer.setSingleShot(true);
+            _timer.start();
+        } else {
+            _timer.stop();
+        }
+    }
+}
+
 void PinentryConfirm::showEvent(QShowEvent *event)
 {
     static bool resized;
@@ -103,6 +141,7 @@ void PinentryConfirm::showEvent(QShowEvent *event)
     }
 
     QMessageBox::showEvent(event);
+    pinentry_trace_mark("window-mapped");
 
     if (timeout() > std::chrono::milliseconds::zero()) {
         _timer.setSingleShot(true);
@@ -32,6 +32,7 @@
 #include "accessibility.h"
 #include "capslock.h"
 #include "pinlineedit.h"
+#include "secmem++.h"
 #include "util.h"
 
 #include <QGridLayout>
@@ -53,10 +54,13 @@
 #include <QVBoxLayout>
 #include <QMessageBox>
 #include <QRegularExpression>
+#include <QSocketNotifier>
 #include <QAccessible>
 
 #include <QDebug>
 
+#include <new>
+
 #ifdef Q_OS_WIN
 #include <windows.h>
 #endif
@@ -113,9 +117,6 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     }
 #endif
 
-    QPalette redTextPalette;
-    redTextPalette.setColor(QPalette::WindowText, Qt::red);
-
     auto *const mainLayout = new QVBoxLayout{this};
 
     auto *const hbox = new QHBoxLayout;
@@ -124,143 +125,79 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     _icon->setPixmap(applicationIconPixmap());
     hbox->addWidget(_icon, 0, Qt::AlignVCenter | Qt::AlignLeft);
 
-    auto *const grid = new QGridLayout;
-    int row = 1;
-
-    _error = new QLabel{this};
-    _error->setTextFormat(Qt::PlainText);
-    _error->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    _error->setPalette(redTextPalette);
-    _error->hide();
-    grid->addWidget(_error, row, 1, 1, 2);
+    /* Only the widgets which every prompt needs are created here.
+       The others are created when they are first needed, in their own
+       row of the grid; an empty row takes no space.  */
+    mGrid = new QGridLayout;
 
-    row++;
-    _desc = new QLabel{this};
-    _desc->setTextFormat(Qt::PlainText);
-    _desc->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    _desc = createLabel(DescriptionRow, 1, 2);
     _desc->hide();
-    grid->addWidget(_desc,  row, 1, 1, 2);
-
-    row++;
-    mCapsLockHint = new QLabel{this};
-    mCapsLockHint->setTextFormat(Qt::PlainText);
-    mCapsLockHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mCapsLockHint->setPalette(redTextPalette);
-    mCapsLockHint->setAlignment(Qt::AlignCenter);
-    mCapsLockHint->setVisible(false);
-    grid->addWidget(mCapsLockHint, row, 1, 1, 2);
-
-    row++;
-    {
-        _prompt = new QLabel(this);
-        _prompt->setTextFormat(Qt::PlainText);
-        _prompt->setTextInteractionFlags(Qt::TextSelectableByMouse);
-        _prompt->hide();
-        grid->addWidget(_prompt, row, 1);
-
-        const auto l = new QHBoxLayout;
-        _edit = new PinLineEdit(this);
-        _edit->setMaxLength(256);
-        _edit->setMinimumWidth(_edit->fontMetrics().averageCharWidth()*20 + 48);
-        _edit->setEchoMode(QLineEdit::Password);
-        _prompt->setBuddy(_edit);
-        l->addWidget(_edit, 1);
-
-        if (!repeatString.isNull()) {
-            mGenerateButton = new QPushButton{this};
-            mGenerateButton->setIcon(QIcon(QLatin1String(":/icons/password-generate") + mIconSuffix));
-            mGenerateButton->setVisible(false);
-            l->addWidget(mGenerateButton);
-        }
-        grid->addLayout(l, row, 2);
-    }
 
-    /* Set up the show password action */
-    const QIcon visibilityIcon = QIcon(QLatin1String(":/icons/visibility") + mIconSuffix);
-    const QIcon hideIcon = QIcon(QLatin1String(":/icons/hint") + mIconSuffix);
+    _prompt = createLabel(PassphraseRow, 1, 1);
+    _prompt->hide();
+
+    mPassphraseLayout = new QHBoxLayout;
+    _edit = new PinLineEdit(this);
+    _edit->setMaxLength(256);
+    _edit->setMinimumWidth(_edit->fontMetrics().averageCharWidth()*20 + 48);
+    _edit->setEchoMode(QLineEdit::Password);
+    _prompt->setBuddy(_edit);
+    mPassphraseLayout->addWidget(_edit, 1);
+    mGrid->addLayout(mPassphraseLayout, PassphraseRow, 2);
+
+    /* Set up the show password action; the action itself is only
+       added to the line edit once there is something to show.  */
 #if QT_VERSION >= 0x050200
-    if (!visibilityIcon.isNull() && !hideIcon.isNull()) {
-        mVisiActionEdit = _edit->addAction(visibilityIcon, QLineEdit::TrailingPosition);
-        mVisiActionEdit->setVisible(false);
-        mVisiActionEdit->setToolTip(mVisibilityTT);
-    } else
+    mUseVisibilityAction = !QIcon(QLatin1String(":/icons/visibility") + mIconSuffix).isNull()
+        && !QIcon(QLatin1String(":/icons/hint") + mIconSuffix).isNull();
 #endif
-    {
-        if (!mVisibilityTT.isNull()) {
-            row++;
-            mVisiCB = new QCheckBox{mVisibilityTT, this};
-            grid->addWidget(mVisiCB, row, 1, 1, 2, Qt::AlignLeft);
-        }
+    if (!mUseVisibilityAction && !mVisibilityTT.isNull()) {
+        mVisiCB = new QCheckBox{mVisibilityTT, this};
+        mGrid->addWidget(mVisiCB, VisibilityCheckBoxRow, 1, 1, 2, Qt::AlignLeft);
     }
 
-    row++;
-    mConstraintsHint = new QLabel{this};
-    mConstraintsHint->setTextFormat(Qt::PlainText);
-    mConstraintsHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mConstraintsHint->setVisible(false);
-    grid->addWidget(mConstraintsHint, row, 2);
-
-    row++;
-    mFormattedPassphraseHintSpacer = new QLabel{this};
-    mFormattedPassphraseHintSpacer->setVisible(false);
-    mFormattedPassphraseHint = new QLabel{this};
-    mFormattedPassphraseHint->setTextFormat(Qt::PlainText);
-    mFormattedPassphraseHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mFormattedPassphraseHint->setVisible(false);
-    grid->addWidget(mFormattedPassphraseHintSpacer, row, 1);
-    grid->addWidget(mFormattedPassphraseHint, row, 2);
-
     if (!repeatString.isNull()) {
-        row++;
-        auto repeatLabel = new QLabel{this};
-        repeatLabel->setTextFormat(Qt::PlainText);
-        repeatLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+        auto repeatLabel = createLabel(RepeatRow, 1, 1);
         repeatLabel->setText(repeatString);
-        grid->addWidget(repeatLabel, row, 1);
 
         mRepeat = new PinLineEdit(this);
         mRepeat->setMaxLength(256);
         mRepeat->setEchoMode(QLineEdit::Password);
         repeatLabel->setBuddy(mRepeat);
-        grid->addWidget(mRepeat, row, 2);
-
-        row++;
-        mRepeatError = new QLabel{this};
-        mRepeatError->setTextFormat(Qt::PlainText);
-        mRepeatError->setTextInteractionFlags(Qt::TextSelectableByMouse);
-        mRepeatError->setPalette(redTextPalette);
-        mRepeatError->hide();
-        grid->addWidget(mRepeatError, row, 2);
+        mGrid->addWidget(mRepeat, RepeatRow, 2);
     }
 
     if (_have_quality_bar) {
-        row++;
-        _quality_bar_label = new QLabel(this);
-        _quality_bar_label->setTextFormat(Qt::PlainText);
-        _quality_bar_label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+        _quality_bar_label = createLabel(QualityBarRow, 1, 1);
         _quality_bar_label->setAlignment(Qt::AlignVCenter);
-        grid->addWidget(_quality_bar_label, row, 1);
 
         _quality_bar = new QProgressBar(this);
         _quality_bar->setAlignment(Qt::AlignCenter);
         _quality_bar_label->setBuddy(_quality_bar);
-        grid->addWidget(_quality_bar, row, 2);
+        mGrid->addWidget(_quality_bar, QualityBarRow, 2);
+
+        /* Keystrokes in quick succession are coalesced into a single
+           inquiry.  */
+        mQualityTimer = new QTimer(this);
+        mQualityTimer->setSingleShot(true);
+        mQualityTimer->setInterval(100);
+        connect(mQualityTimer, &QTimer::timeout,
+                this, &PinEntryDialog::submitQuality);
     }
 
-    ++row;
-    mSavePassphraseCB = new QCheckBox{this};
-    mSavePassphraseCB->setVisible(false);
-    mSavePassphraseCB->setCheckState(!!_pinentry_info->may_cache_password
-                                     ? Qt::Checked
-                                     : Qt::Unchecked);
 #ifdef HAVE_LIBSECRET
     if (_pinentry_info->allow_external_password_cache && _pinentry_info->keyinfo) {
-        mSavePassphraseCB->setVisible(true);
+        mSavePassphraseCB = new QCheckBox{this};
+        mSavePassphraseCB->setCheckState(!!_pinentry_info->may_cache_password
+                                         ? Qt::Checked
+                                         : Qt::Unchecked);
+        mGrid->addWidget(mSavePassphraseCB, SavePassphraseRow, 1, 1, 2);
+        connect(mSavePassphraseCB, &QCheckBox::toggled,
+                this, &PinEntryDialog::togglePasswordCaching);
     }
 #endif
-    grid->addWidget(mSavePassphraseCB, row, 1, 1, 2);
 
-    hbox->addLayout(grid, 1);
+    hbox->addLayout(mGrid, 1);
     mainLayout->addLayout(hbox);
 
     QDialogButtonBox *const buttons = new QDialogButtonBox(this);
@@ -283,6 +220,18 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
         _timer->start(_pinentry_info->timeout * 1000);
     }
 
+    const int liveFd = pinentry_get_input_fd(_pinentry_info);
+    if (liveFd != -1) {
+        mLiveNotifier = new QSocketNotifier(liveFd, QSocketNotifier::Read, this);
+        connect(mLiveNotifier, &QSocketNotifier::activated,
+                this, &PinEntryDialog::processLiveInput);
+        /* Commands sent right behind GETPIN may already be buffered, in
+           which case the descriptor does not become readable.  */
+        if (pinentry_input_pending(_pinentry_info)) {
+            QTimer::singleShot(0, this, &PinEntryDialog::processLiveInput);
+        }
+    }
+
     connect(buttons, &QDialogButtonBox::accepted,
             this, &PinEntryDialog::onAccept);
     connect(buttons, &QDialogButtonBox::rejected,
@@ -293,14 +242,6 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
             this, &PinEntryDialog::textChanged);
     connect(_edit, &PinLineEdit::backspacePressed,
             this, &PinEntryDialog::onBackspace);
-    if (mGenerateButton) {
-        connect(mGenerateButton, &QPushButton::clicked,
-                this, &PinEntryDialog::generatePin);
-    }
-    if (mVisiActionEdit) {
-        connect(mVisiActionEdit, &QAction::triggered,
-                this, &PinEntryDialog::toggleVisibility);
-    }
     if (mVisiCB) {
         connect(mVisiCB, &QCheckBox::toggled,
                 this, &PinEntryDialog::toggleVisibility);
@@ -309,20 +250,11 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
         connect(mRepeat, &QLineEdit::textChanged,
                 this, &PinEntryDialog::textChanged);
     }
-    connect(mSavePassphraseCB, &QCheckBox::toggled,
-            this, &PinEntryDialog::togglePasswordCaching);
-
-    auto capsLockWatcher = new CapsLockWatcher{this};
-    connect(capsLockWatcher, &CapsLockWatcher::stateChanged,
-            this, [this] (bool locked) {
-                mCapsLockHint->setVisible(locked);
-            });
 
     connect(qApp, &QApplication::focusChanged,
             this, &PinEntryDialog::focusChanged);
     connect(qApp, &QApplication::applicationStateChanged,
             this, &PinEntryDialog::checkCapsLock);
-    checkCapsLock();
 
 #ifndef QT_NO_ACCESSIBILITY
     QAccessible::installActivationObserver(this);
@@ -356,6 +288,64 @@ PinEntryDialog::~PinEntryDialog()
 #endif
 }
 
+/* Create a label for a text and add it to the grid at ROW.  */
+QLabel *PinEntryDialog::createLabel(int row, int column, int columnSpan)
+{
+    auto label = new QLabel{this};
+    label->setTextFormat(Qt::PlainText);
+    label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    mGrid->addWidget(label, row, column, 1, columnSpan);
+    return label;
+}
+
+/* Create a label for a message which is created on demand.  Like the
+   other messages, it can get the focus if accessibility is active.  */
+QLabel *PinEntryDialog::createMessageLabel(int row, int column, int columnSpan)
+{
+    auto label = createLabel(row, column, columnSpan);
+#ifndef QT_NO_ACCESSIBILITY
+    label->setFocusPolicy(QAccessible::isActive() ? Qt::StrongFocus : Qt::ClickFocus);
+#endif
+    return label;
+}
+
+/* Create a label for an error or a warning which is created on
+   demand.  */
+QLabel *PinEntryDialog::createErrorLabel(int row, int column, int columnSpan)
+{
+    QPalette redTextPalette;
+    redTextPalette.setColor(QPalette::WindowText, Qt::red);
+
+    auto label = createMessageLabel(row, column, columnSpan);
+    label->setPalette(redTextPalette);
+    return label;
+}
+
+QAction *PinEntryDialog::visibilityAction()
+{
+    if (!mVisiActionEdit && mUseVisibilityAction) {
+        mVisiActionEdit = _edit->addAction(QIcon(QLatin1String(":/icons/visibility") + mIconSuffix), QLineEdit::TrailingPosition);
+        mVisiActionEdit->setVisible(false);
+        mVisiActionEdit->setToolTip(mVisibilityTT);
+        connect(mVisiActionEdit, &QAction::triggered,
+                this, &PinEntryDialog::toggleVisibility);
+    }
+    return mVisiActionEdit;
+}
+
+void PinEntryDialog::setCapsLockHintVisible(bool visible)
+{
+    if (!mCapsLockHint) {
+        if (!visible) {
+            return;
+        }
+        mCapsLockHint = createErrorLabel(CapsLockHintRow, 1, 2);
+        mCapsLockHint->setAlignment(Qt::AlignCenter);
+        mCapsLockHint->setText(mCapsLockHintText);
+    }
+    mCapsLockHint->setVisible(visible);
+}
+
 void PinEntryDialog::keyPressEvent(QKeyEvent *e)
 {
     const auto returnPressed =
@@ -382,7 +372,17 @@ void PinEntryDialog::keyReleaseEvent(QKeyEvent *event)
 void PinEntryDialog::showEvent(QShowEvent *event)
 {
     QDialog::showEvent(event);
+    pinentry_trace_mark("window-mapped");
     _edit->setFocus();
+
+    /* Watching Caps Lock may need a round trip to the display server,
+       so it is started only after the dialog is on the screen.  */
+    if (!mCapsLockWatcher) {
+        mCapsLockWatcher = new CapsLockWatcher{this};
+        connect(mCapsLockWatcher, &CapsLockWatcher::stateChanged,
+                this, &PinEntryDialog::setCapsLockHintVisible);
+        QTimer::singleShot(0, this, &PinEntryDialog::checkCapsLock);
+    }
 }
 
 void PinEntryDialog::setDescription(const QString &txt)
@@ -403,13 +403,19 @@ void PinEntryDialog::setError(const QString &txt)
     if (!txt.isNull()) {
         _icon->setPixmap(applicationIconPixmap(QIcon{QStringLiteral(":/icons/data-error.svg")}));
     }
+    if (!_error) {
+        if (txt.isEmpty()) {
+            return;
+        }
+        _error = createErrorLabel(ErrorRow, 1, 2);
+    }
     _error->setText(txt);
     _error->setVisible(!txt.isEmpty());
 }
 
 QString PinEntryDialog::error() const
 {
-    return _error->text();
+    return _error ? _error->text() : QString();
 }
 
 void PinEntryDialog::setPin(const QString &txt)
@@ -463,9 +469,17 @@ void PinEntryDialog::setQualityBarTT(const QString &txt)
 
 void PinEntryDialog::setGenpinLabel(const QString &txt)
 {
-    if (!mGenerateButton) {
+    if (!mRepeat || (!mGenerateButton && txt.isEmpty())) {
         return;
     }
+    if (!mGenerateButton) {
+        mGenerateButton = new QPushButton{this};
+        mGenerateButton->setIcon(QIcon(QLatin1String(":/icons/password-generate") + mIconSuffix));
+        mGenerateButton->setToolTip(mGenpinTT);
+        mPassphraseLayout->addWidget(mGenerateButton);
+        connect(mGenerateButton, &QPushButton::clicked,
+                this, &PinEntryDialog::generatePin);
+    }
     mGenerateButton->setVisible(!txt.isEmpty());
     if (!txt.isEmpty()) {
         Accessibility::setName(mGenerateButton, txt);
@@ -474,6 +488,7 @@ void PinEntryDialog::setGenpinLabel(const QString &txt)
 
 void PinEntryDialog::setGenpinTT(const QString &txt)
 {
+    mGenpinTT = txt;
     if (mGenerateButton) {
         mGenerateButton->setToolTip(txt);
     }
@@ -481,21 +496,42 @@ void PinEntryDialog::setGenpinTT(const QString &txt)
 
 void PinEntryDialog::setCapsLockHint(const QString &txt)
 {
-    mCapsLockHint->setText(txt);
+    mCapsLockHintText = txt;
+    if (mCapsLockHint) {
+        mCapsLockHint->setText(txt);
+    }
 }
 
 void PinEntryDialog::setFormattedPassphrase(const PinEntryDialog::FormattedPassphraseOptions &options)
 {
     mFormatPassphrase = options.formatPassphrase;
-    mFormattedPassphraseHint->setTextFormat(Qt::RichText);
-    mFormattedPassphraseHint->setText(QLatin1String("<html>") + options.hint.toHtmlEscaped() + QLatin1String("</html>"));
-    Accessibility::setName(mFormattedPassphraseHint, options.hint);
+    if (mFormatPassphrase && !mFormattedPassphraseHint) {
+        mFormattedPassphraseHintSpacer = new QLabel{this};
+        mFormattedPassphraseHintSpacer->setVisible(false);
+        mGrid->addWidget(mFormattedPassphraseHintSpacer, FormattedPassphraseHintRow, 1);
+        mFormattedPassphraseHint = createMessageLabel(FormattedPassphraseHintRow, 2, 1);
+        mFormattedPassphraseHint->setVisible(false);
+    }
+    if (mFormattedPassphraseHint) {
+        mFormattedPassphraseHint->setTextFormat(Qt::RichText);
+        mFormattedPassphraseHint->setText(QLatin1String("<html>") + options.hint.toHtmlEscaped() + QLatin1String("</html>"));
+        Accessibility::setName(mFormattedPassphraseHint, options.hint);
+    }
     toggleFormattedPassphrase();
 }
 
 void PinEntryDialog::setConstraintsOptions(const ConstraintsOptions &options)
 {
     mEnforceConstraints = options.enforce;
+    mConstraintsErrorTitle = options.errorTitle;
+
+    const bool showHint = mEnforceConstraints && !options.shortHint.isEmpty();
+    if (!mConstraintsHint) {
+        if (!showHint) {
+            return;
+        }
+        mConstraintsHint = createMessageLabel(ConstraintsHintRow, 2, 1);
+    }
     mConstraintsHint->setText(options.shortHint);
     if (!options.longHint.isEmpty()) {
         mConstraintsHint->setToolTip(QLatin1String("<html>") +
@@ -503,9 +539,8 @@ void PinEntryDialog::setConstraintsOptions(const ConstraintsOptions &options)
                                     QLatin1String("</html>"));
         Accessibility::setDescription(mConstraintsHint, options.longHint);
     }
-    mConstraintsErrorTitle = options.errorTitle;
 
-    mConstraintsHint->setVisible(mEnforceConstraints && !options.shortHint.isEmpty());
+    mConstraintsHint->setVisible(showHint);
 }
 
 void PinEntryDialog::toggleFormattedPassphrase()
@@ -514,6 +549,8 @@ void PinEntryDialog::toggleFormattedPassphrase()
     _edit->setFormattedPassphrase(enableFormatting);
     if (mRepeat) {
         mRepeat->setFormattedPassphrase(enableFormatting);
+    }
+    if (mFormattedPassphraseHint) {
         const bool hintAboutToBeHidden = mFormattedPassphraseHint->isVisible() && !enableFormatting;
         if (hintAboutToBeHidden) {
             // set hint spacer to current height of hint label before hiding the hint
@@ -543,39 +580,98 @@ void PinEntryDialog::onBackspace()
     }
 }
 
+/* Store the passphrase in EDIT as UTF-8 in secure memory at PIN.
+   Returns false if the secure memory is exhausted.  This is called
+   from slots, so it must not throw.  */
+static bool pinUtf8(const PinLineEdit *edit, secmem::string &pin)
+{
+    if (const int length = edit->pinUtf8Length()) {
+        try {
+            pin.resize(length);
+        } catch (const std::bad_alloc &) {
+            return false;
+        }
+        edit->pinToUtf8(pin.data());
+    }
+    return true;
+}
+
 void PinEntryDialog::updateQuality(const QString &txt)
 {
-    int length;
-    int percent;
-    QPalette pal;
+    int value;
 
     _disable_echo_allowed = false;
 
     if (!_have_quality_bar || !_pinentry_info) {
         return;
     }
-    const QByteArray utf8_pin = txt.toUtf8();
-    const char *pin = utf8_pin.constData();
-    length = strlen(pin);
-    percent = length ? pinentry_inq_quality(_pinentry_info, pin, length) : 0;
-    if (!length) {
+    if (txt.isEmpty()) {
+        mQualityTimer->stop();
+        mQualityRequest = 0;
         _quality_bar->reset();
-    } else {
-        pal = _quality_bar->palette();
-        if (percent < 0) {
-            pal.setColor(QPalette::Highlight, QColor("red"));
-            percent = -percent;
-        } else {
-            pal.setColor(QPalette::Highlight, QColor("green"));
+        return;
+    }
+
+    /* The local estimate is cheap enough for every keystroke.  */
+    {
+        secmem::string pin;
+        if (pinUtf8(_edit, pin)
+            && pinentry_quality_estimate(_pinentry_info, pin.c_str(), pin.size(), &value)) {
+            showQuality(value);
+        }
+    }
+    if (_pinentry_info->quality_mode != PINENTRY_QUALITY_LOCAL) {
+        mQualityTimer->start();
+    }
+}
+
+/* Ask the client for the quality of the current passphrase.  The
+   inquiry runs asynchronously if the core can watch for the response;
+   the result then arrives in processLiveInput.  A request superseded
+   by a newer one is dropped by the core.  */
+void PinEntryDialog::submitQuality()
+{
+    if (_edit->isPinEmpty()) {
+        return;
+    }
+    secmem::string utf8_pin;
+    if (!pinUtf8(_edit, utf8_pin)) {
+        return;
+    }
+    const char *pin = utf8_pin.c_str();
+    const int length = utf8_pin.size();
+    int fd;
+    int value;
+
+    mQualityRequest = pinentry_inq_quality_submit(_pinentry_info, pin, length, &fd);
+    if (mQualityRequest) {
+        /* The result may already be known.  */
+        if (pinentry_inq_quality_collect(_pinentry_info, &value) == mQualityRequest) {
+            showQuality(value);
         }
-        _quality_bar->setPalette(pal);
-        _quality_bar->setValue(percent);
+        return;
+    }
+    showQuality(pinentry_inq_quality(_pinentry_info, pin, length));
+}
+
+void PinEntryDialog::showQuality(int percent)
+{
+    QPalette pal = _quality_bar->palette();
+    if (percent < 0) {
+        pal.setColor(QPalette::Highlight, QColor("red"));
+        percent = -percent;
+    } else {
+        pal.setColor(QPalette::Highlight, QColor("green"));
     }
+    _quality_bar->setPalette(pal);
+    _quality_bar->setValue(percent);
 }
 
 void PinEntryDialog::setSavePassphraseCBText(const QString &text)
 {
-    mSavePassphraseCB->setText(text);
+    if (mSavePassphraseCB) {
+        mSavePassphraseCB->setText(text);
+    }
 }
 
 void PinEntryDialog::focusChanged(QWidget *old, QWidget *now)
@@ -598,14 +694,18 @@ void PinEntryDialog::textChanged(const QString &text)
 {
     Q_UNUSED(text);
 
+    pinentry_note_input(_pinentry_info);
     cancelTimeout();
 
-    if (mVisiActionEdit && sender() == _edit) {
-        mVisiActionEdit->setVisible(!_edit->pin().isEmpty());
+    if (sender() == _edit) {
+        const bool empty = _edit->isPinEmpty();
+        if (QAction *action = empty ? mVisiActionEdit : visibilityAction()) {
+            action->setVisible(!empty);
+        }
     }
     if (mGenerateButton) {
         mGenerateButton->setVisible(
-            _edit->pin().isEmpty()
+            _edit->isPinEmpty()
 #ifndef QT_NO_ACCESSIBILITY
             && !mGenerateButton->accessibleName().isEmpty()
 #endif
@@ -618,8 +718,8 @@ void PinEntryDialog::generatePin()
     unique_malloced_ptr<char> pin{pinentry_inq_genpin(_pinentry_info)};
     if (pin) {
         if (_edit->echoMode() == QLineEdit::Password) {
-            if (mVisiActionEdit) {
-                mVisiActionEdit->trigger();
+            if (QAction *action = visibilityAction()) {
+                action->trigger();
             }
             if (mVisiCB) {
                 mVisiCB->setChecked(true);
@@ -680,6 +780,21 @@ QString PinEntryDialog::repeatedPin() const
     return QString();
 }
 
+bool PinEntryDialog::repeatedPinMatches() const
+{
+    return mRepeat ? _edit->hasSamePin(mRepeat) : _edit->isPinEmpty();
+}
+
+int PinEntryDialog::pinUtf8Length() const
+{
+    return _edit->pinUtf8Length();
+}
+
+void PinEntryDialog::pinToUtf8(char *buffer) const
+{
+    _edit->pinToUtf8(buffer);
+}
+
 bool PinEntryDialog::timedOut() const
 {
     return _timed_out;
@@ -687,6 +802,7 @@ bool PinEntryDialog::timedOut() const
 
 void PinEntryDialog::setRepeatErrorText(const QString &err)
 {
+    mRepeatErrorText = err;
     if (mRepeatError) {
         mRepeatError->setText(err);
     }
@@ -699,11 +815,43 @@ void PinEntryDialog::cancelTimeout()
     }
 }
 
+void PinEntryDialog::processLiveInput()
+{
+    const int flags = pinentry_process_input(_pinentry_info);
+
+    if (flags & PINENTRY_LIVE_CANCEL) {
+        mLiveNotifier->setEnabled(false);
+        reject();
+        return;
+    }
+    if (flags & PINENTRY_LIVE_ERROR) {
+        setError(QString::fromUtf8(_pinentry_info->error));
+    }
+    if (flags & PINENTRY_LIVE_QUALITY) {
+        int value;
+        if (mQualityRequest
+            && pinentry_inq_quality_collect(_pinentry_info, &value) == mQualityRequest) {
+            showQuality(value);
+        }
+    }
+    if (flags & PINENTRY_LIVE_TIMEOUT) {
+        if (_pinentry_info->timeout > 0) {
+            if (!_timer) {
+                _timer = new QTimer(this);
+                connect(_timer, &QTimer::timeout, this, &PinEntryDialog::slotTimeout);
+            }
+            _timer->start(_pinentry_info->timeout * 1000);
+        } else {
+            cancelTimeout();
+        }
+    }
+}
+
 void PinEntryDialog::checkCapsLock()
 {
     const auto state = capsLockState();
     if (state != LockState::Unknown) {
-        mCapsLockHint->setVisible(state == LockState::On);
+        setCapsLockHintVisible(state == LockState::On);
     }
 }
 
@@ -711,13 +859,17 @@ void PinEntryDialog::onAccept()
 {
     cancelTimeout();
 
-    if (mRepeat && mRepeat->pin() != _edit->pin()) {
+    if (mRepeat && !_edit->hasSamePin(mRepeat)) {
 #ifndef QT_NO_ACCESSIBILITY
         if (QAccessible::isActive()) {
-            QMessageBox::information(this, mRepeatError->text(), mRepeatError->text());
+            QMessageBox::information(this, mRepeatErrorText, mRepeatErrorText);
         } else
 #endif
         {
+            if (!mRepeatError) {
+                mRepeatError = createErrorLabel(RepeatErrorRow, 2, 1);
+                mRepeatError->setText(mRepeatErrorText);
+            }
             mRepeatError->setVisible(true);
         }
         return;
@@ -734,13 +886,11 @@ void PinEntryDialog::accessibilityActiveChanged(bool active)
 {
     // Allow text labels to get focus if accessibility is active
     const auto focusPolicy = active ? Qt::StrongFocus : Qt::ClickFocus;
-    _error->setFocusPolicy(focusPolicy);
-    _desc->setFocusPolicy(focusPolicy);
-    mCapsLockHint->setFocusPolicy(focusPolicy);
-    mConstraintsHint->setFocusPolicy(focusPolicy);
-    mFormattedPassphraseHint->setFocusPolicy(focusPolicy);
-    if (mRepeatError) {
-        mRepeatError->setFocusPolicy(focusPolicy);
+    for (QLabel *label : {_error, _desc, mCapsLockHint, mConstraintsHint,
+                          mFormattedPassphraseHint, mRepeatError}) {
+        if (label) {
+            label->setFocusPolicy(focusPolicy);
+        }
     }
 }
 #endif
@@ -751,9 +901,12 @@ PinEntryDialog::PassphraseCheckResult PinEntryDialog::checkConstraints()
         return PassphraseNotChecked;
     }
 
-    const auto passphrase = _edit->pin().toUtf8();
+    secmem::string passphrase;
+    if (!pinUtf8(_edit, passphrase)) {
+        return PassphraseNotChecked;
+    }
     unique_malloced_ptr<char> error{pinentry_inq_checkpin(
-        _pinentry_info, passphrase.constData(), passphrase.size())};
+        _pinentry_info, passphrase.c_str(), passphrase.size())};
 
     if (!error) {
         return PassphraseOk;
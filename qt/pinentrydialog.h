@@ -37,11 +37,15 @@ class QIcon;
 class QLabel;
 class QPushButton;
 class QLineEdit;
+class CapsLockWatcher;
 class PinLineEdit;
 class QString;
 class QProgressBar;
 class QCheckBox;
+class QGridLayout;
+class QHBoxLayout;
 class QAction;
+class QSocketNotifier;
 
 QPixmap applicationIconPixmap(const QIcon &overlayIcon = {});
 
@@ -89,6 +93,11 @@ public:
     QString pin() const;
 
     QString repeatedPin() const;
+    bool repeatedPinMatches() const;
+
+    /* See PinLineEdit::pinUtf8Length and PinLineEdit::pinToUtf8.  */
+    int pinUtf8Length() const;
+    void pinToUtf8(char *buffer) const;
     void setRepeatErrorText(const QString &);
 
     void setPrompt(const QString &);
@@ -131,6 +140,8 @@ protected:
 
 private Q_SLOTS:
     void cancelTimeout();
+    void processLiveInput();
+    void submitQuality();
     void checkCapsLock();
     void onAccept();
 
@@ -145,6 +156,27 @@ private:
         PassphraseOk
     };
     PassphraseCheckResult checkConstraints();
+    void showQuality(int percent);
+
+    /* The rows of the grid.  */
+    enum {
+        ErrorRow = 1,
+        DescriptionRow,
+        CapsLockHintRow,
+        PassphraseRow,
+        VisibilityCheckBoxRow,
+        ConstraintsHintRow,
+        FormattedPassphraseHintRow,
+        RepeatRow,
+        RepeatErrorRow,
+        QualityBarRow,
+        SavePassphraseRow
+    };
+    QLabel *createLabel(int row, int column, int columnSpan);
+    QLabel *createMessageLabel(int row, int column, int columnSpan);
+    QLabel *createErrorLabel(int row, int column, int columnSpan);
+    QAction *visibilityAction();
+    void setCapsLockHintVisible(bool visible);
 
 private:
     QLabel    *_icon = nullptr;
@@ -156,6 +188,7 @@ private:
     PinLineEdit *_edit = nullptr;
     PinLineEdit *mRepeat = nullptr;
     QLabel      *mRepeatError = nullptr;
+    QString      mRepeatErrorText;
     QPushButton *_ok = nullptr;
     QPushButton *_cancel = nullptr;
     bool       _grabbed = false;
@@ -166,14 +199,23 @@ private:
     bool       mFormatPassphrase = false;
     pinentry_t _pinentry_info = nullptr;
     QTimer    *_timer = nullptr;
+    QGridLayout *mGrid = nullptr;
+    QHBoxLayout *mPassphraseLayout = nullptr;
+    QSocketNotifier *mLiveNotifier = nullptr;
+    QTimer    *mQualityTimer = nullptr;
+    int        mQualityRequest = 0;
     QString    mVisibilityTT;
     QString    mHideTT;
+    bool       mUseVisibilityAction = false;
     QAction   *mVisiActionEdit = nullptr;
     QPushButton *mGenerateButton = nullptr;
+    QString    mGenpinTT;
     QCheckBox *mVisiCB = nullptr;
     QLabel    *mFormattedPassphraseHint = nullptr;
     QLabel    *mFormattedPassphraseHintSpacer = nullptr;
     QLabel    *mCapsLockHint = nullptr;
+    QString    mCapsLockHintText;
+    CapsLockWatcher *mCapsLockWatcher = nullptr;
     QLabel    *mConstraintsHint = nullptr;
     QString   mConstraintsErrorTitle;
     QCheckBox *mSavePassphraseCB = nullptr;
@@ -339,6 +339,8 @@ int
 main(int argc, char *argv[])
 {
     pinentry_init("pinentry-qt");
+    pinentry_set_features(PINENTRY_FEATURE_QUALITY_BAR
+                          | PINENTRY_FEATURE_GENPIN);
 
     QApplication *app = NULL;
     int new_argc = 0;
@@ -347,6 +349,7 @@ main(int argc, char *argv[])
     if (!pinentry_have_display(argc, argv)) {
         pinentry_cmd_handler = curses_cmd_handler;
         pinentry_set_flavor_flag ("curses");
+        pinentry_set_features(PINENTRY_CURSES_FEATURES);
     } else
 #endif
     {
@@ -217,6 +217,7 @@ qt_cmd_handler(pinentry_t pe)
         QStringLiteral("Save passphrase in password manager");
 
     if (want_pass) {
+        pinentry_trace_begin("create-dialog");
         PinEntryDialog pinentry(pe, nullptr, 0, true,
                                 repeatString, visibilityTT, hideTT);
         setup_foreground_window(&pinentry, pe->parent_wid);
@@ -255,6 +256,7 @@ qt_cmd_handler(pinentry_t pe)
         if (pe->quality_bar_tt) {
             pinentry.setQualityBarTT(from_utf8(pe->quality_bar_tt));
         }
+        pinentry_trace_end("create-dialog");
         bool ret = pinentry.exec();
         if (!ret) {
             if (pinentry.timedOut())
@@ -262,21 +264,20 @@ qt_cmd_handler(pinentry_t pe)
             return -1;
         }
 
-        const QString pinStr = pinentry.pin();
-        QByteArray pin = pinStr.toUtf8();
-
         if (!!pe->repeat_passphrase) {
             /* Should not have been possible to accept
                the dialog in that case but we do a safety
                check here */
-            pe->repeat_okay = (pinStr == pinentry.repeatedPin());
+            pe->repeat_okay = pinentry.repeatedPinMatches();
         }
 
-        int len = strlen(pin.constData());
+        /* The passphrase goes straight from the dialog into the
+           secure buffer.  */
+        int len = pinentry.pinUtf8Length();
         if (len >= 0) {
             pinentry_setbufferlen(pe, len + 1);
             if (pe->pin) {
-                strcpy(pe->pin, pin.constData());
+                pinentry.pinToUtf8(pe->pin);
                 return len;
             }
         }
@@ -290,10 +291,12 @@ qt_cmd_handler(pinentry_t pe)
             pe->notok      ? QMessageBox::Yes | QMessageBox::No | QMessageBox::Cancel :
             /* else */       QMessageBox::Ok | QMessageBox::Cancel ;
 
+        pinentry_trace_begin("create-dialog");
         PinentryConfirm box{QMessageBox::Information, title, desc, buttons};
         box.setTextFormat(Qt::PlainText);
         box.setTextInteractionFlags(Qt::TextSelectableByMouse);
         box.setTimeout(std::chrono::seconds{pe->timeout});
+        box.watchInput(pe);
         setup_foreground_window(&box, pe->parent_wid);
 
         const struct {
@@ -319,6 +322,7 @@ qt_cmd_handler(pinentry_t pe)
             box.setDefaultButton(QMessageBox::Cancel);
         }
 
+        pinentry_trace_end("create-dialog");
         box.show();
         raiseWindow(&box);
 
@@ -356,6 +360,13 @@ int
 main(int argc, char *argv[])
 {
     pinentry_init("pinentry-qt5");
+    pinentry_set_features(PINENTRY_FEATURE_QUALITY_BAR
+                          | PINENTRY_FEATURE_GENPIN
+                          | PINENTRY_FEATURE_FORMATTED
+                          | PINENTRY_FEATURE_CONSTRAINTS
+                          | PINENTRY_FEATURE_EXTERNAL_CACHE
+                          | PINENTRY_FEATURE_ASYNC_QUALITY
+                          | PINENTRY_FEATURE_LIVE_UPDATES);
 
     QApplication *app = NULL;
     int new_argc = 0;
@@ -379,6 +390,7 @@ main(int argc, char *argv[])
     if (!isGUISession) {
         pinentry_cmd_handler = curses_cmd_handler;
         pinentry_set_flavor_flag ("curses");
+        pinentry_set_features(PINENTRY_CURSES_FEATURES);
     } else
 #endif
     {
@@ -421,10 +433,12 @@ main(int argc, char *argv[])
          */
         new_argc = argc;
         Q_ASSERT (new_argc);
+        pinentry_trace_begin("qapplication");
         app = new QApplication(new_argc, new_argv);
         app->setWindowIcon(QIcon(QLatin1String(":/icons/pinentry.png")));
         app->setDesktopFileName(QStringLiteral("org.gnupg.pinentry-qt5"));
         (void) new KeyboardFocusIndication{app};
+        pinentry_trace_end("qapplication");
     }
 
     pinentry_parse_opts(argc, argv);
@@ -27,6 +27,10 @@
 #include <QMessageBox>
 #include <QTimer>
 
+#include "pinentry.h"
+
+class QSocketNotifier;
+
 class PinentryConfirm : public QMessageBox
 #ifndef QT_NO_ACCESSIBILITY
     , public QAccessible::ActivationObserver
@@ -44,11 +48,16 @@ public:
 
     bool timedOut() const;
 
+    /* Process the commands which the client of PE sends while the box
+       is open.  */
+    void watchInput(pinentry_t pe);
+
 protected:
     void showEvent(QShowEvent *event) override;
 
 private Q_SLOTS:
     void slotTimeout();
+    void processLiveInput();
 
 private:
 #ifndef QT_NO_ACCESSIBILITY
@@ -58,6 +67,8 @@ private:
 private:
     QTimer _timer;
     bool _timed_out = false;
+    pinentry_t _pinentry_info = nullptr;
+    QSocketNotifier *_liveNotifier = nullptr;
 };
 
 #endif
@@ -49,14 +49,55 @@ public:
         : q{q}
     {}
 
-    QString formatted(QString text) const
+    static bool isSeparatorPosition(int i)
     {
-        const int dashCount = text.size() / FormattedPassphraseGroupSize;
-        text.reserve(text.size() + dashCount);
-        for (int i = FormattedPassphraseGroupSize; i < text.size(); i += FormattedPassphraseGroupSize + 1) {
-            text.insert(i, FormattedPassphraseSeparator);
+        return i % (FormattedPassphraseGroupSize + 1) == FormattedPassphraseGroupSize;
+    }
+
+    /* Return the position of the first character of TEXT which is not
+       where it would be in a formatted passphrase, or the size of TEXT
+       if TEXT is formatted.  After an edit this is where the edit
+       starts; the groups before it do not need to be touched.  */
+    static int firstMisformatted(const QString &text)
+    {
+        const QChar *s = text.constData();
+        const int size = text.size();
+        for (int i = 0; i < size; i++) {
+            if (isSeparatorPosition(i) != (s[i] == FormattedPassphraseSeparator)) {
+                return i;
+            }
         }
-        return text;
+        // a separator must not end the text
+        if (size > 0 && isSeparatorPosition(size - 1)) {
+            return size - 1;
+        }
+        return size;
+    }
+
+    /* Return TEXT formatted, assuming that the characters before FROM
+       are already formatted.  The rest is regrouped in a single pass,
+       dropping any separators in it.  */
+    static QString formatted(const QString &text, int from = 0)
+    {
+        const QChar *s = text.constData();
+        const int size = text.size();
+        QString result;
+        result.reserve(size + size / FormattedPassphraseGroupSize);
+        result.append(s, from);
+        for (int i = from; i < size; i++) {
+            if (s[i] == FormattedPassphraseSeparator) {
+                continue;
+            }
+            if (isSeparatorPosition(result.size())) {
+                result.append(FormattedPassphraseSeparator);
+            }
+            result.append(s[i]);
+        }
+        // the edit may have removed everything after a kept separator
+        if (!result.isEmpty() && isSeparatorPosition(result.size() - 1)) {
+            result.chop(1);
+        }
+        return result;
     }
 
     Selection formattedSelection(Selection selection) const
@@ -70,12 +111,17 @@ public:
         };
     }
 
-    QString unformatted(QString text) const
+    static QString unformatted(const QString &text)
     {
-        for (int i = FormattedPassphraseGroupSize; i < text.size(); i += FormattedPassphraseGroupSize) {
-            text.remove(i, 1);
+        const QChar *s = text.constData();
+        QString result;
+        result.reserve(text.size());
+        for (int i = 0; i < text.size(); i++) {
+            if (!isSeparatorPosition(i)) {
+                result.append(s[i]);
+            }
         }
-        return text;
+        return result;
     }
 
     Selection unformattedSelection(Selection selection) const
@@ -89,6 +135,81 @@ public:
         };
     }
 
+    bool isSeparator(int i) const
+    {
+        return mFormattedPassphrase && isSeparatorPosition(i);
+    }
+
+    /* Convert the passphrase to UTF-8, store it at BUFFER unless that
+       is NULL, and return its length.  Unpaired surrogates are
+       replaced by U+FFFD.  */
+    int toUtf8(char *buffer) const
+    {
+        const QString text = q->text(); // shares the data of the widget
+        const QChar *s = text.constData();
+        unsigned char *out = reinterpret_cast<unsigned char *>(buffer);
+        int length = 0;
+        char32_t high = 0;
+
+        const auto put = [out, &length](char32_t c) {
+            unsigned char b[4];
+            int n;
+            if (c < 0x80) {
+                b[0] = c;
+                n = 1;
+            } else if (c < 0x800) {
+                b[0] = 0xc0 | (c >> 6);
+                b[1] = 0x80 | (c & 0x3f);
+                n = 2;
+            } else if (c < 0x10000) {
+                b[0] = 0xe0 | (c >> 12);
+                b[1] = 0x80 | ((c >> 6) & 0x3f);
+                b[2] = 0x80 | (c & 0x3f);
+                n = 3;
+            } else {
+                b[0] = 0xf0 | (c >> 18);
+                b[1] = 0x80 | ((c >> 12) & 0x3f);
+                b[2] = 0x80 | ((c >> 6) & 0x3f);
+                b[3] = 0x80 | (c & 0x3f);
+                n = 4;
+            }
+            if (out) {
+                for (int i = 0; i < n; i++) {
+                    out[length + i] = b[i];
+                }
+            }
+            length += n;
+        };
+
+        for (int i = 0; i < text.size(); i++) {
+            if (isSeparator(i)) {
+                continue;
+            }
+            char32_t c = s[i].unicode();
+            if (high) {
+                if (c >= 0xdc00 && c < 0xe000) {
+                    put(0x10000 + ((high - 0xd800) << 10) + (c - 0xdc00));
+                    high = 0;
+                    continue;
+                }
+                put(0xfffd);
+                high = 0;
+            }
+            if (c >= 0xd800 && c < 0xdc00) {
+                high = c;
+            } else {
+                put(c >= 0xdc00 && c < 0xe000 ? 0xfffd : c);
+            }
+        }
+        if (high) {
+            put(0xfffd);
+        }
+        if (out) {
+            out[length] = 0;
+        }
+        return length;
+    }
+
     void copyToClipboard()
     {
         if (q->echoMode() != QLineEdit::Normal) {
@@ -173,6 +294,44 @@ QString PinLineEdit::pin() const
     }
 }
 
+bool PinLineEdit::isPinEmpty() const
+{
+    return text().isEmpty();
+}
+
+bool PinLineEdit::hasSamePin(const PinLineEdit *other) const
+{
+    const QString a = text();
+    const QString b = other->text();
+    int i = 0;
+    int j = 0;
+
+    for (;;) {
+        while (i < a.size() && d->isSeparator(i)) {
+            i++;
+        }
+        while (j < b.size() && other->d->isSeparator(j)) {
+            j++;
+        }
+        if (i == a.size() || j == b.size()) {
+            return i == a.size() && j == b.size();
+        }
+        if (a[i++] != b[j++]) {
+            return false;
+        }
+    }
+}
+
+int PinLineEdit::pinUtf8Length() const
+{
+    return d->toUtf8(nullptr);
+}
+
+void PinLineEdit::pinToUtf8(char *buffer) const
+{
+    d->toUtf8(buffer);
+}
+
 void PinLineEdit::keyPressEvent(QKeyEvent *e)
 {
     if (e == QKeySequence::Copy) {
@@ -215,18 +374,25 @@ void PinLineEdit::textEdited()
     if (!d->mFormattedPassphrase) {
         return;
     }
-    auto currentText = text();
-    // first calculate the cursor position in the reformatted text; the cursor
-    // is put left of the separators, so that backspace works as expected
-    auto cursorPos = cursorPosition();
-    cursorPos -= QStringView{currentText}.left(cursorPos).count(FormattedPassphraseSeparator);
-    cursorPos += std::max(cursorPos - 1, 0) / FormattedPassphraseGroupSize;
-    // then reformat the text
-    currentText.remove(FormattedPassphraseSeparator);
-    currentText = d->formatted(currentText);
-    // finally, set reformatted text and updated cursor position
-    setText(currentText);
-    setCursorPosition(cursorPos);
+    const auto currentText = text();
+    // the groups in front of the edit are still formatted
+    const int start = d->firstMisformatted(currentText);
+    // first calculate the cursor position in the reformatted text from the number
+    // of characters in front of it; the cursor is put left of the separators,
+    // so that backspace works as expected
+    const int cursor = cursorPosition();
+    const int before = std::min(cursor, start);
+    int chars = before - before / (FormattedPassphraseGroupSize + 1);
+    if (cursor > start) {
+        chars += cursor - start
+            - QStringView{currentText}.mid(start, cursor - start).count(FormattedPassphraseSeparator);
+    }
+    // then reformat the text from the start of the edit on, unless the edit
+    // left it formatted as is the case when typing inside the last group
+    if (start < currentText.size()) {
+        setText(d->formatted(currentText, start));
+    }
+    setCursorPosition(chars + std::max(chars - 1, 0) / FormattedPassphraseGroupSize);
 }
 
 #include "pinlineedit.moc"
@@ -37,6 +37,16 @@ public:
     void setPin(const QString &pin);
     QString pin() const;
 
+    bool isPinEmpty() const;
+    bool hasSamePin(const PinLineEdit *other) const;
+
+    /* The passphrase in UTF-8 is serialized straight from the text of
+       the widget, without the separators of a formatted passphrase and
+       without any intermediate copy on the heap.  pinToUtf8 writes
+       pinUtf8Length() bytes and a Nul to BUFFER.  */
+    int pinUtf8Length() const;
+    void pinToUtf8(char *buffer) const;
+
 public Q_SLOTS:
     void setFormattedPassphrase(bool on);
     void copy() const;
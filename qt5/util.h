@@ -25,6 +25,8 @@
 
 #include <stdlib.h>
 
+#include "secmem.h"
+
 namespace _detail
 {
 struct FreeDeleter {
@@ -32,9 +34,17 @@ struct FreeDeleter {
         free(ptr);
     }
 };
+struct SecmemFreeDeleter {
+    void operator()(void *ptr) const {
+        secmem_free(ptr);
+    }
+};
 }
 
 template<class T>
 using unique_malloced_ptr = std::unique_ptr<T, _detail::FreeDeleter>;
 
+template<class T>
+using unique_secmem_ptr = std::unique_ptr<T, _detail::SecmemFreeDeleter>;
+
 #endif // __PINENTRY_QT_UTIL_H__
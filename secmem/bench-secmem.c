@@ -0,0 +1,682 @@
+/* bench-secmem.c - Benchmark for the secure memory allocator.
+   Copyright (C) 2026 g10 Code GmbH
+
+   This file is part of PINENTRY.
+
+   PINENTRY is free software; you can redistribute it and/or modify it
+   under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   PINENTRY is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <https://www.gnu.org/licenses/>.
+   SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program replays the allocation pattern of a long GETPIN with
+   INQUIRE QUALITY after each keystroke and reports the average cost
+   of an allocation.  With --patterns it runs a few other synthetic
+   patterns and with --replay it replays a trace recorded by running a
+   pinentry with PINENTRY_SECMEM_TRACE set to a file name; for those
+   it also reports the peak use of the pool and its fragmentation.
+   With --wipe it reports the cost of wiping freed memory for each
+   wipe policy instead.  With --threads it hammers the
+   allocator from several threads and checks that no thread sees the
+   data of another.  It is not built by default; use "make
+   bench-secmem" to build it.  */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "secmem.h"
+
+/* The longest passphrase typed in a session.  */
+#define MAX_PASSPHRASE 64
+
+/* The number of strings set up by the SET and OPTION commands.  */
+#define N_STRINGS 24
+
+
+/* Return the time in nanoseconds.  */
+static double
+now (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+#endif
+}
+
+
+/* Allocate SIZE bytes and die if that fails.  */
+static void *
+xsecmem_malloc (size_t size)
+{
+  void *p = secmem_malloc (size);
+
+  if (!p)
+    {
+      fprintf (stderr, "bench-secmem: out of secure memory\n");
+      secmem_dump_stats ();
+      exit (1);
+    }
+  return p;
+}
+
+
+/* Run one GETPIN with KEYSTROKES inquiries and return the number of
+   allocations.  */
+static unsigned long
+run_session (int keystrokes)
+{
+  unsigned long count = 0;
+  char *pin, *line, *response, *ctx;
+  char *strings[N_STRINGS];
+  size_t len;
+  int i;
+
+  /* The context, the minimum pin buffer of pinentry_setbufferlen
+     and the strings of the dialog live for the whole session.  */
+  ctx = xsecmem_malloc (600);
+  pin = xsecmem_malloc (2048);
+  count += 2;
+  for (i = 0; i < N_STRINGS; i++)
+    {
+      strings[i] = xsecmem_malloc (8 + (i * 37) % 200);
+      count++;
+    }
+
+  for (i = 0; i < keystrokes; i++)
+    {
+      len = i % MAX_PASSPHRASE + 1;
+
+      /* The percent escaped "INQUIRE QUALITY" line.  */
+      line = xsecmem_malloc (16 + 3 * len + 1);
+      memset (line, 'x', 16 + len);
+
+      /* The data line of the response, grown by assuan.  */
+      response = xsecmem_malloc (16);
+      response = secmem_realloc (response, 80);
+      if (!response)
+        {
+          fprintf (stderr, "bench-secmem: out of secure memory\n");
+          exit (1);
+        }
+      count += 3;
+
+      secmem_free (response);
+      secmem_free (line);
+    }
+
+  /* The strings are released in a different order.  */
+  for (i = 0; i < N_STRINGS; i++)
+    secmem_free (strings[(i * 7) % N_STRINGS]);
+  secmem_free (pin);
+  secmem_free (ctx);
+  return count;
+}
+
+
+/* Reallocate P to SIZE bytes and die if that fails.  */
+static void *
+xsecmem_realloc (void *p, size_t size)
+{
+  p = secmem_realloc (p, size);
+  if (!p)
+    {
+      fprintf (stderr, "bench-secmem: out of secure memory\n");
+      secmem_dump_stats ();
+      exit (1);
+    }
+  return p;
+}
+
+
+/* Print the cost per operation of the run NAME of COUNT operations
+   which took ELAPSED ns and the use of the pool as in ST.  */
+static void
+report (const char *name, unsigned long count, double elapsed,
+        const struct secmem_stats *st)
+{
+  printf ("%-18s %8lu ops %7.1f ns/op   peak %6lu of %6lu bytes"
+          "   %3u%% fragmented\n",
+          name, count, elapsed / count, (unsigned long)st->max_alloced,
+          (unsigned long)st->poolsize,
+          st->free_bytes
+          ? 100 - (unsigned)(st->largest_free * 100 / st->free_bytes) : 0);
+}
+
+
+/* The pin buffer of pinentry_setbufferlen doubled for a long pasted
+   passphrase while the dialog allocates a few strings.  The pool
+   statistics are stored at ST before everything is freed.  */
+static unsigned long
+pattern_pin_doubling (struct secmem_stats *st)
+{
+  char *pin, *strings[4];
+  size_t len;
+  unsigned long count = 0;
+  int i;
+
+  pin = xsecmem_malloc (2048);
+  count++;
+  for (len = 4096, i = 0; len <= 32768; len *= 2, i++)
+    {
+      if (i < 4)
+        {
+          strings[i] = xsecmem_malloc (40 + i * 30);
+          count++;
+        }
+      pin = xsecmem_realloc (pin, len);
+      count++;
+    }
+
+  secmem_get_stats (st);
+  for (i = 0; i < 4; i++)
+    secmem_free (strings[i]);
+  secmem_free (pin);
+  return count + 5;
+}
+
+
+/* The lines and data buffers of assuan with overlapping lifetimes as
+   when a client sends SET commands while INQUIREs are answered.  The
+   pool statistics are stored at ST before everything is freed.  */
+static unsigned long
+pattern_assuan_churn (struct secmem_stats *st)
+{
+  char *ring[8] = { NULL };
+  char *buffer;
+  unsigned long count = 0;
+  int i, k;
+
+  for (i = 0; i < 200; i++)
+    {
+      k = i % 8;
+      secmem_free (ring[k]);
+      ring[k] = xsecmem_malloc (16 + (i * 131) % 1000);
+
+      /* A data buffer grown while the response arrives.  */
+      buffer = xsecmem_malloc (64);
+      buffer = xsecmem_realloc (buffer, 256);
+      buffer = xsecmem_realloc (buffer, 1024);
+      secmem_free (buffer);
+      count += (i >= 8) + 5;
+    }
+
+  secmem_get_stats (st);
+  for (k = 0; k < 8; k++)
+    secmem_free (ring[k]);
+  return count + 8;
+}
+
+
+/* A SecTQString grown by one character per keystroke to 128
+   characters and converted to UTF-8 after each keystroke.  The pool
+   statistics are stored at ST before everything is freed.  */
+static unsigned long
+pattern_sectqstring (struct secmem_stats *st)
+{
+  char *unicode, *utf8;
+  unsigned int len, maxl = 4;
+  unsigned long count = 0;
+
+  unicode = xsecmem_malloc (2 * maxl);
+  count++;
+  for (len = 1; len <= 128; len++)
+    {
+      /* See SecTQString::setLength and computeNewMax.  */
+      if (len > maxl)
+        {
+          maxl *= 2;
+          unicode = xsecmem_realloc (unicode, 2 * maxl);
+          count++;
+        }
+
+      /* See SecTQString::utf8.  */
+      utf8 = xsecmem_malloc (3 * len + 1);
+      utf8 = xsecmem_realloc (utf8, len + 1);
+      count += 2;
+      if (len < 128)
+        {
+          secmem_free (utf8);
+          count++;
+        }
+    }
+
+  secmem_get_stats (st);
+  secmem_free (utf8);
+  secmem_free (unicode);
+  return count + 2;
+}
+
+
+/* Run each synthetic pattern on a fresh pool.  */
+static void
+bench_patterns (void)
+{
+  static const struct
+  {
+    const char *name;
+    unsigned long (*func) (struct secmem_stats *);
+  } patterns[] =
+    {
+      { "pin-doubling", pattern_pin_doubling },
+      { "assuan-churn", pattern_assuan_churn },
+      { "sectqstring", pattern_sectqstring }
+    };
+  struct secmem_stats st;
+  unsigned long count;
+  double start, elapsed;
+  size_t i;
+  int round;
+
+  for (i = 0; i < sizeof patterns / sizeof *patterns; i++)
+    {
+      secmem_init (1);
+      secmem_set_flags (SECMEM_DONT_WARN);
+
+      count = 0;
+      start = now ();
+      for (round = 0; round < 2000; round++)
+        count += patterns[i].func (&st);
+      elapsed = now () - start;
+      report (patterns[i].name, count, elapsed, &st);
+
+      secmem_term ();
+    }
+}
+
+
+/* An operation of a trace.  */
+struct trace_op
+{
+  char op;
+  unsigned int id;
+  size_t size;
+};
+
+
+/* Replay the trace in FNAME.  Returns 0 on success.  */
+static int
+bench_replay (const char *fname)
+{
+  struct trace_op *ops = NULL;
+  size_t n_ops = 0, max_ops = 0;
+  unsigned int max_id = 0;
+  void **blocks;
+  struct secmem_stats st;
+  char line[100];
+  unsigned long size, count = 0;
+  double start, elapsed = 0;
+  FILE *fp;
+  size_t i;
+  int n, pass, passes;
+
+  fp = fopen (fname, "r");
+  if (!fp)
+    {
+      fprintf (stderr, "bench-secmem: can't open '%s'\n", fname);
+      return 1;
+    }
+  while (fgets (line, sizeof line, fp))
+    {
+      if (*line == '#')
+        continue;
+      if (n_ops == max_ops)
+        {
+          max_ops = max_ops ? 2 * max_ops : 1024;
+          ops = realloc (ops, max_ops * sizeof *ops);
+          if (!ops)
+            {
+              fprintf (stderr, "bench-secmem: out of core\n");
+              exit (1);
+            }
+        }
+      size = 0;
+      n = sscanf (line, "%c %u %lu", &ops[n_ops].op, &ops[n_ops].id, &size);
+      if (n < 2 || !strchr ("mrf", ops[n_ops].op)
+          || (n < 3 && ops[n_ops].op != 'f'))
+        {
+          fprintf (stderr, "bench-secmem: invalid trace line: %s", line);
+          return 1;
+        }
+      ops[n_ops].size = size;
+      if (ops[n_ops].id > max_id)
+        max_id = ops[n_ops].id;
+      n_ops++;
+    }
+  fclose (fp);
+  if (!n_ops)
+    {
+      fprintf (stderr, "bench-secmem: empty trace\n");
+      return 1;
+    }
+
+  blocks = calloc (max_id + 1, sizeof *blocks);
+  if (!blocks)
+    {
+      fprintf (stderr, "bench-secmem: out of core\n");
+      exit (1);
+    }
+
+  secmem_init (1);
+  secmem_set_flags (SECMEM_DONT_WARN);
+
+  /* Replay the trace often enough to get a stable result.  Blocks
+     still allocated at the end of the trace are freed between the
+     passes; this is not timed.  */
+  passes = n_ops < 1000000 ? 1000000 / n_ops : 1;
+  for (pass = 0; pass < passes; pass++)
+    {
+      start = now ();
+      for (i = 0; i < n_ops; i++)
+        {
+          void **p = &blocks[ops[i].id];
+
+          switch (ops[i].op)
+            {
+            case 'm':
+              *p = secmem_malloc (ops[i].size);
+              break;
+            case 'r':
+              /* On failure the block stays as it was.  */
+              {
+                void *q = secmem_realloc (*p, ops[i].size);
+                if (q)
+                  *p = q;
+              }
+              break;
+            case 'f':
+              secmem_free (*p);
+              *p = NULL;
+              break;
+            }
+        }
+      elapsed += now () - start;
+      count += n_ops;
+
+      secmem_get_stats (&st);
+      for (i = 0; i <= max_id; i++)
+        {
+          secmem_free (blocks[i]);
+          blocks[i] = NULL;
+        }
+    }
+
+  report (fname, count, elapsed, &st);
+  if (st.failed_allocs)
+    printf ("%lu allocations failed\n", st.failed_allocs);
+
+  secmem_term ();
+  free (blocks);
+  free (ops);
+  return 0;
+}
+
+
+/* Report the cost per KiB of wiping blocks of SIZE bytes on free
+   with the wipe policy FLAGS named NAME.  */
+static void
+bench_wipe (const char *name, unsigned int flags, size_t size)
+{
+  int rounds = 20000;
+  double start, elapsed;
+  void *p;
+  int i;
+
+  secmem_set_flags (SECMEM_DONT_WARN | flags);
+
+  start = now ();
+  for (i = 0; i < rounds; i++)
+    {
+      p = xsecmem_malloc (size);
+      secmem_free (p);
+    }
+  elapsed = now () - start;
+
+  printf ("%-12s %6lu byte blocks: %8.1f ns per KiB\n", name,
+          (unsigned long)size, elapsed / rounds / (size / 1024.0));
+}
+
+
+#ifdef HAVE_PTHREAD
+/* The number of operations of each thread in the stress test.  */
+#define STRESS_ROUNDS 200000
+
+/* The number of blocks each thread holds at a time.  */
+#define STRESS_SLOTS 8
+
+/* The state of a thread in the stress test.  */
+struct stress_thread
+{
+  pthread_t thread;
+  unsigned int seed;
+  unsigned char tag;     /* The byte the thread fills its blocks with.  */
+  unsigned long failed;  /* The number of allocations which failed.  */
+  int corrupted;
+};
+
+
+/* Return true if the first N bytes at P are all TAG.  */
+static int
+check_block (const unsigned char *p, size_t n, unsigned char tag)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (p[i] != tag)
+      return 0;
+  return 1;
+}
+
+
+/* Randomly allocate, grow, shrink and free blocks filled with the tag
+   of the thread described by ARG and check them before each change.
+   Running out of secure memory is counted but not fatal.  */
+static void *
+stress_thread (void *arg)
+{
+  struct stress_thread *st = arg;
+  unsigned char *slot[STRESS_SLOTS] = { NULL };
+  size_t len[STRESS_SLOTS] = { 0 };
+  unsigned char *p;
+  size_t n;
+  int i, k;
+
+  for (i = 0; i < STRESS_ROUNDS && !st->corrupted; i++)
+    {
+      k = rand_r (&st->seed) % STRESS_SLOTS;
+      /* Mostly small blocks as in a pinentry, some larger ones.  */
+      n = rand_r (&st->seed) % 8 ? rand_r (&st->seed) % 128 + 1
+                                 : rand_r (&st->seed) % 2048 + 1;
+
+      if (slot[k] && !check_block (slot[k], len[k], st->tag))
+        st->corrupted = 1;
+      else if (!slot[k])
+        {
+          slot[k] = secmem_malloc (n);
+          if (!slot[k])
+            {
+              st->failed++;
+              continue;
+            }
+          if (!check_block (slot[k], n, 0))
+            st->corrupted = 1;
+          memset (slot[k], st->tag, n);
+          len[k] = n;
+        }
+      else if (rand_r (&st->seed) % 2)
+        {
+          p = secmem_realloc (slot[k], n);
+          if (!p)
+            {
+              st->failed++;
+              continue;
+            }
+          slot[k] = p;
+          if (n > len[k])
+            memset (p + len[k], st->tag, n - len[k]);
+          len[k] = n;
+        }
+      else
+        {
+          secmem_free (slot[k]);
+          slot[k] = NULL;
+        }
+    }
+
+  for (k = 0; k < STRESS_SLOTS; k++)
+    secmem_free (slot[k]);
+  return NULL;
+}
+
+
+/* Run the stress test with NTHREADS threads.  Returns 0 if no thread
+   found a corrupted block.  */
+static int
+bench_threads (int nthreads)
+{
+  struct stress_thread *threads;
+  unsigned long failed = 0;
+  double start, elapsed;
+  int corrupted = 0;
+  int i;
+
+  threads = calloc (nthreads, sizeof *threads);
+  if (!threads)
+    {
+      fprintf (stderr, "bench-secmem: out of core\n");
+      return 1;
+    }
+
+  secmem_init (1);
+  secmem_set_flags (SECMEM_DONT_WARN | SECMEM_WIPE_ONCE);
+
+  start = now ();
+  for (i = 0; i < nthreads; i++)
+    {
+      threads[i].seed = i + 1;
+      threads[i].tag = i % 255 + 1;
+      if (pthread_create (&threads[i].thread, NULL, stress_thread,
+                          &threads[i]))
+        {
+          fprintf (stderr, "bench-secmem: can't create thread\n");
+          exit (1);
+        }
+    }
+  for (i = 0; i < nthreads; i++)
+    {
+      pthread_join (threads[i].thread, NULL);
+      failed += threads[i].failed;
+      corrupted |= threads[i].corrupted;
+    }
+  elapsed = now () - start;
+
+  printf ("%d threads: %.1f ns per operation, %lu failed allocations%s\n",
+          nthreads, elapsed / ((double)nthreads * STRESS_ROUNDS), failed,
+          corrupted ? ", CORRUPTED BLOCKS" : "");
+  secmem_dump_stats ();
+
+  secmem_term ();
+  free (threads);
+  return corrupted;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+int
+main (int argc, char **argv)
+{
+  int sessions = 100;
+  int keystrokes = 1000;
+  unsigned long count = 0;
+  double start, elapsed;
+  int i;
+
+  if (argc == 2 && !strcmp (argv[1], "--wipe"))
+    {
+      static const size_t sizes[] = { 1024, 4096, 8192 };
+      size_t n;
+
+      secmem_init (1);
+      for (n = 0; n < sizeof sizes / sizeof *sizes; n++)
+        {
+          bench_wipe ("multi-pass", 0, sizes[n]);
+          bench_wipe ("once", SECMEM_WIPE_ONCE, sizes[n]);
+        }
+      secmem_term ();
+      return 0;
+    }
+
+  if (argc == 2 && !strcmp (argv[1], "--patterns"))
+    {
+      bench_patterns ();
+      return 0;
+    }
+
+  if (argc == 3 && !strcmp (argv[1], "--replay"))
+    return bench_replay (argv[2]);
+
+#ifdef HAVE_PTHREAD
+  if (argc == 3 && !strcmp (argv[1], "--threads") && atoi (argv[2]) > 0)
+    return bench_threads (atoi (argv[2]));
+#endif
+
+  if (argc > 1)
+    sessions = atoi (argv[1]);
+  if (argc > 2)
+    keystrokes = atoi (argv[2]);
+  if (argc > 3 || sessions < 1 || keystrokes < 1)
+    {
+      fprintf (stderr, "usage: bench-secmem [SESSIONS [KEYSTROKES]]\n"
+               "       bench-secmem --patterns\n"
+               "       bench-secmem --replay FILE\n"
+               "       bench-secmem --wipe\n"
+#ifdef HAVE_PTHREAD
+               "       bench-secmem --threads N\n"
+#endif
+               );
+      return 1;
+    }
+
+  secmem_init (1);
+  secmem_set_flags (SECMEM_DONT_WARN);
+
+  start = now ();
+  for (i = 0; i < sessions; i++)
+    count += run_session (keystrokes);
+  elapsed = now () - start;
+
+  printf ("%d sessions with %d inquiries: %lu allocations, "
+          "%.1f ns per allocation\n",
+          sessions, keystrokes, count, elapsed / count);
+  secmem_dump_stats ();
+
+  secmem_term ();
+  return 0;
+}
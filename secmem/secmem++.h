@@ -21,6 +21,13 @@
 
 #include "../secmem/secmem.h"
 #include <cstddef>
+#if __cplusplus >= 201703L
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#endif
 
 namespace secmem {
 
@@ -86,6 +93,226 @@ namespace secmem {
     template <typename T1, typename T2>
     bool operator!=( const alloc<T1> &, const alloc<T2> & ) { return false; }
 
+#if __cplusplus >= 201703L
+
+    // C++17 allocator for the standard containers.  All instances are
+    // equal since there is only one pool.
+    template <typename T>
+    struct allocator {
+        static_assert( alignof(T) <= alignof(std::max_align_t),
+                       "secmem does not support over-aligned types" );
+
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using is_always_equal = std::true_type;
+
+        allocator() noexcept = default;
+        template <typename U> allocator( const allocator<U> & ) noexcept {}
+
+        [[nodiscard]] T * allocate( std::size_t n ) {
+            if ( n > max_size() )
+                throw std::bad_array_new_length();
+            if ( void * p = secmem_malloc( n * sizeof(T) ) )
+                return static_cast<T*>( p );
+            throw std::bad_alloc();
+        }
+
+        void deallocate( T * p, std::size_t ) noexcept {
+            secmem_free( p );
+        }
+
+        std::size_t max_size() const noexcept {
+            return secmem_get_max_size() / sizeof(T);
+        }
+    };
+
+    template <typename T1, typename T2>
+    bool operator==( const allocator<T1> &, const allocator<T2> & ) noexcept { return true; }
+    template <typename T1, typename T2>
+    bool operator!=( const allocator<T1> &, const allocator<T2> & ) noexcept { return false; }
+
+    namespace detail {
+        // Overwrite memory in a way the compiler may not elide.
+        inline void wipe( void * p, std::size_t n ) noexcept {
+            volatile char * v = static_cast<volatile char *>( p );
+            while ( n-- )
+                *v++ = 0;
+        }
+    }
+
+    // A move-only byte buffer in secure memory.  The contents are
+    // always followed by a Nul byte which is not counted in size().
+    // The first allocation is at least min_capacity bytes, so that a
+    // typical passphrase never needs to grow; such small blocks are
+    // usually taken from the per-thread cache of secmem.
+    class bytes {
+    public:
+        using size_type = std::size_t;
+        static constexpr size_type min_capacity = 63;
+
+        bytes() noexcept = default;
+        bytes( const void * p, size_type n ) { append( p, n ); }
+        bytes( const bytes & ) = delete;
+        bytes & operator=( const bytes & ) = delete;
+        bytes( bytes && other ) noexcept
+            : m_data( std::exchange( other.m_data, nullptr ) ),
+              m_size( std::exchange( other.m_size, 0 ) ),
+              m_capacity( std::exchange( other.m_capacity, 0 ) ) {}
+        bytes & operator=( bytes && other ) noexcept {
+            if ( this != &other ) {
+                reset();
+                m_data = std::exchange( other.m_data, nullptr );
+                m_size = std::exchange( other.m_size, 0 );
+                m_capacity = std::exchange( other.m_capacity, 0 );
+            }
+            return *this;
+        }
+        ~bytes() { reset(); }
+
+        char * data() noexcept { return m_data; }
+        const char * data() const noexcept { return m_data; }
+        size_type size() const noexcept { return m_size; }
+        size_type capacity() const noexcept { return m_capacity; }
+        bool empty() const noexcept { return !m_size; }
+
+        char * begin() noexcept { return m_data; }
+        char * end() noexcept { return m_data + m_size; }
+        const char * begin() const noexcept { return m_data; }
+        const char * end() const noexcept { return m_data + m_size; }
+
+        // Make room for N bytes.  Throws std::bad_alloc if the pool is
+        // exhausted; the buffer is unchanged then.
+        void reserve( size_type n ) {
+            if ( n <= m_capacity )
+                return;
+            if ( n < 2 * m_capacity )
+                n = 2 * m_capacity;
+            if ( n < min_capacity )
+                n = min_capacity;
+            // secmem_realloc grows in place if it can.
+            char * p = static_cast<char*>( secmem_realloc( m_data, n + 1 ) );
+            if ( !p )
+                throw std::bad_alloc();
+            if ( !m_data )
+                p[0] = 0;
+            m_data = p;
+            m_capacity = n;
+        }
+
+        // Set the size to N.  Added bytes are zero, removed bytes are
+        // wiped.
+        void resize( size_type n ) {
+            reserve( n );
+            if ( n > m_size )
+                std::memset( m_data + m_size, 0, n - m_size );
+            else if ( m_data )
+                detail::wipe( m_data + n, m_size - n );
+            m_size = n;
+            if ( m_data )
+                m_data[n] = 0;
+        }
+
+        void append( const void * p, size_type n ) {
+            reserve( m_size + n );
+            if ( n )
+                std::memcpy( m_data + m_size, p, n );
+            m_size += n;
+            if ( m_data )
+                m_data[m_size] = 0;
+        }
+
+        void push_back( char c ) { append( &c, 1 ); }
+
+        // Wipe the contents but keep the storage.
+        void clear() noexcept { resize_down( 0 ); }
+
+        // Return the storage to secmem.
+        void reset() noexcept {
+            secmem_free( m_data );
+            m_data = nullptr;
+            m_size = m_capacity = 0;
+        }
+
+        // Hand the Nul terminated storage over to C code, for example
+        // to pinentry_setbuffer_use.  The caller has to secmem_free
+        // it.
+        char * release() noexcept {
+            m_size = m_capacity = 0;
+            return std::exchange( m_data, nullptr );
+        }
+
+    protected:
+        void resize_down( size_type n ) noexcept {
+            if ( !m_data || n >= m_size )
+                return;
+            detail::wipe( m_data + n, m_size - n );
+            m_size = n;
+        }
+
+        char * m_data = nullptr;
+        size_type m_size = 0;
+        size_type m_capacity = 0;
+    };
+
+    // A move-only UTF-8 string in secure memory.
+    class string : public bytes {
+    public:
+        using bytes::bytes;
+
+        explicit string( std::string_view s ) : bytes( s.data(), s.size() ) {}
+
+        const char * c_str() const noexcept { return m_data ? m_data : ""; }
+        std::string_view view() const noexcept { return { c_str(), m_size }; }
+
+        void append( std::string_view s ) { bytes::append( s.data(), s.size() ); }
+        using bytes::append;
+
+        // Append the UTF-16 text S of N code units converted to UTF-8
+        // without going through any other buffer.  Unpaired surrogates
+        // are replaced by U+FFFD.
+        void append_utf16( const char16_t * s, size_type n ) {
+            if ( !n )
+                return;
+            // Each code unit yields at most 3 bytes; a pair yields 4.
+            reserve( m_size + 3 * n );
+            unsigned char * d = reinterpret_cast<unsigned char*>( m_data + m_size );
+            for ( size_type i = 0; i < n; i++ ) {
+                char32_t c = s[i];
+                if ( c >= 0xd800 && c < 0xdc00 && i + 1 < n
+                     && s[i+1] >= 0xdc00 && s[i+1] < 0xe000 )
+                    c = 0x10000 + ((c - 0xd800) << 10) + (s[++i] - 0xdc00);
+                else if ( c >= 0xd800 && c < 0xe000 )
+                    c = 0xfffd;
+
+                if ( c < 0x80 )
+                    *d++ = c;
+                else if ( c < 0x800 ) {
+                    *d++ = 0xc0 | (c >> 6);
+                    *d++ = 0x80 | (c & 0x3f);
+                } else if ( c < 0x10000 ) {
+                    *d++ = 0xe0 | (c >> 12);
+                    *d++ = 0x80 | ((c >> 6) & 0x3f);
+                    *d++ = 0x80 | (c & 0x3f);
+                } else {
+                    *d++ = 0xf0 | (c >> 18);
+                    *d++ = 0x80 | ((c >> 12) & 0x3f);
+                    *d++ = 0x80 | ((c >> 6) & 0x3f);
+                    *d++ = 0x80 | (c & 0x3f);
+                }
+            }
+            m_size = reinterpret_cast<char*>( d ) - m_data;
+            m_data[m_size] = 0;
+        }
+
+        static string from_utf16( const char16_t * s, size_type n ) {
+            string result;
+            result.append_utf16( s, n );
+            return result;
+        }
+    };
+
+#endif /* C++17 */
+
 }
 
 #endif /* __SECMEM_SECMEMPP_H__ */
@@ -31,7 +31,13 @@
 # include <sys/types.h>
 # include <fcntl.h>
 #endif
+#ifdef HAVE_GETRLIMIT
+# include <sys/resource.h>
+#endif
 #include <string.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "secmem.h"
 
@@ -86,33 +92,127 @@ log_fatal(char *template, ...)
 
 #define DEFAULT_POOLSIZE 16384
 
+/* The pool grows by further segments of at least DEFAULT_POOLSIZE up
+ * to this size.  A further segment is released as soon as it is
+ * completely free again.  */
+#ifndef DEFAULT_MAX_POOLSIZE
+#define DEFAULT_MAX_POOLSIZE (16 * DEFAULT_POOLSIZE)
+#endif
+#define MAX_SEGMENTS 32
+
 typedef struct memblock_struct MEMBLOCK;
 struct memblock_struct {
-    unsigned size;
+    unsigned size;	/* of the block including this header */
+    unsigned prev_size; /* of the block before this one or 0 */
     union {
-	MEMBLOCK *next;
+	struct {
+	    MEMBLOCK *next;
+	    MEMBLOCK *prev;
+	} l;		/* only used while the block is free */
 	PROPERLY_ALIGNED_TYPE aligned;
     } u;
 };
 
-
-
-static void  *pool;
-static volatile int pool_okay; /* may be checked in an atexit function */
+/* Set in SIZE while the block is in a free list.  The sizes of the
+ * neighbours of a block are found by its own size and by PREV_SIZE,
+ * so that adjacent free blocks can be merged in secmem_free.  */
+#define BLOCK_IS_FREE	1
+#define BLOCK_SIZE(mb)	((mb)->size & ~BLOCK_IS_FREE)
+
+/* Blocks are always a multiple of BLOCK_ALIGN.  The free blocks are
+ * kept in one list per size class.  Up to SMALL_LIMIT there is a class
+ * for each multiple of BLOCK_ALIGN, so that all blocks in such a list
+ * have the same size and allocation is a simple pop.  Above that, each
+ * class covers a power of two; the last class takes everything above.
+ */
+#define BLOCK_ALIGN	32
+#define SMALL_LIMIT	1024
+#define N_SMALL_CLASSES (SMALL_LIMIT / BLOCK_ALIGN)
+#define N_CLASSES	(N_SMALL_CLASSES + 20)
+
+
+
+/* A contiguous part of the pool.  */
+typedef struct {
+    char *base;
+    size_t size;	/* allocated length */
+    size_t len;		/* used length */
+    unsigned last_size; /* of the last block in the segment */
+    int is_locked;
+    int is_primary;	/* the one from secmem_init, never released */
+    unsigned *trace_ids; /* by offset / BLOCK_ALIGN while tracing */
 #if HAVE_MMAP
-static int   pool_is_mmapped;
+    int is_mmapped;
 #endif
-static size_t poolsize; /* allocated length */
-static size_t poollen;	/* used length */
-static MEMBLOCK *unused_blocks;
+} SEGMENT;
+
+static SEGMENT segments[MAX_SEGMENTS]; /* sorted by address */
+static int n_segments;
+static volatile int pool_okay; /* may be checked in an atexit function */
+static size_t poolsize; /* allocated length of all segments */
+static size_t max_poolsize = DEFAULT_MAX_POOLSIZE;
+static MEMBLOCK *unused_blocks[N_CLASSES];
 static unsigned max_alloced;
 static unsigned cur_alloced;
 static unsigned max_blocks;
 static unsigned cur_blocks;
+static unsigned long failed_allocs;
+static unsigned long merged_blocks;
 static int disable_secmem;
 static int show_warning;
 static int no_warning;
 static int suspend_warning;
+static int wipe_once;
+
+/* With the envvar PINENTRY_SECMEM_TRACE set to a file name, each
+ * allocation, reallocation and free is written to that file as a line
+ * "m ID SIZE", "r ID SIZE" or "f ID".  The IDs are numbered in order
+ * of allocation; neither addresses nor contents are written.  Such a
+ * trace can be replayed with "bench-secmem --replay".  */
+static FILE *trace_fp;
+static unsigned trace_next_id;
+
+#ifndef HAVE_EXPLICIT_BZERO
+/* Calling memset through a volatile pointer keeps the compiler from
+ * eliding it, while the C library may still use its fastest stores.  */
+static void *(*volatile memset_ptr)(void *, int, size_t) = memset;
+#endif
+
+#ifdef HAVE_PTHREAD
+/* The lock protects the segments, the free lists and the counters.
+ * The pool must be initialized before other threads are started.  */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_POOL()	pthread_mutex_lock( &pool_lock )
+#define UNLOCK_POOL()	pthread_mutex_unlock( &pool_lock )
+
+/* Each thread keeps up to CACHE_DEPTH wiped blocks of each of the
+ * N_CACHED_CLASSES smallest classes but no more than CACHE_LIMIT
+ * bytes, so that most allocations and frees of small blocks do not
+ * need the lock.  A cached block still counts as allocated.  */
+#define N_CACHED_CLASSES N_SMALL_CLASSES
+#define CACHE_DEPTH	 2
+#define CACHE_LIMIT	 2048
+
+typedef struct {
+    unsigned generation; /* of the pool the blocks belong to */
+    size_t bytes;	 /* in all cached blocks */
+    int n[N_CACHED_CLASSES];
+    MEMBLOCK *blocks[N_CACHED_CLASSES][CACHE_DEPTH];
+} THREAD_CACHE;
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static int cache_key_okay;
+#ifdef HAVE___THREAD
+/* The same as the value of CACHE_KEY but faster to get.  */
+static __thread THREAD_CACHE *thread_cache;
+#endif
+/* Incremented by secmem_term so that stale caches are dropped.  */
+static volatile unsigned pool_generation;
+#else
+#define LOCK_POOL()	do { } while( 0 )
+#define UNLOCK_POOL()	do { } while( 0 )
+#endif
 
 
 static void
@@ -123,7 +223,8 @@ print_warn(void)
 }
 
 
-static void
+/* Lock the N bytes at P into memory.  Returns 0 on success.  */
+static int
 lock_pool( void *p, size_t n )
 {
 #if defined(HAVE_MLOCK)
@@ -140,6 +241,13 @@ lock_pool( void *p, size_t n )
     else {
 	err = mlock( p, n );
     }
+#elif defined(HAVE_MLOCK2) && defined(MLOCK_ONFAULT)
+    /* Lock the pages only when they are first used, so that a large
+     * pool does not need to be faulted in at startup.  Older kernels
+     * do not know this flag.  */
+    err = mlock2( p, n, MLOCK_ONFAULT );
+    if( err && (errno == EINVAL || errno == ENOSYS) )
+	err = mlock( p, n );
 #else
     err = mlock( p, n );
 #endif
@@ -158,26 +266,50 @@ lock_pool( void *p, size_t n )
 	    log_error("can't lock memory: %s\n", strerror(errno));
 	show_warning = 1;
     }
+    return err;
 
 #else
     (void)p;
     (void)n;
     log_info("Please note that you don't have secure memory on this system\n");
+    return -1;
 #endif
 }
 
 
-static void
-init_pool( size_t n)
+/* Return the largest size the pool may grow to.  */
+static size_t
+pool_limit( void )
 {
+    size_t limit = max_poolsize;
+#ifdef HAVE_GETRLIMIT
+    struct rlimit rl;
+
+    /* Do not grow beyond what we may lock.  */
+    if( !getrlimit( RLIMIT_MEMLOCK, &rl ) && rl.rlim_cur != RLIM_INFINITY
+	&& rl.rlim_cur < limit )
+	limit = rl.rlim_cur;
+#endif
+    return limit;
+}
+
+
+/* Map a new segment of at least N bytes and add it to SEGMENTS.
+ * Returns the segment or NULL.  */
+static SEGMENT *
+add_segment( size_t n )
+{
+    SEGMENT seg;
+    int i;
 #if HAVE_MMAP
     size_t pgsize;
 #endif
 
-    poolsize = n;
+    if( n_segments == MAX_SEGMENTS )
+	return NULL;
 
-    if( disable_secmem )
-	log_bug("secure memory is disabled");
+    memset( &seg, 0, sizeof seg );
+    seg.size = n;
 
 #if HAVE_MMAP
 #ifdef HAVE_GETPAGESIZE
@@ -186,9 +318,9 @@ init_pool( size_t n)
     pgsize = 4096;
 #endif
 
-    poolsize = (poolsize + pgsize -1 ) & ~(pgsize-1);
+    seg.size = (seg.size + pgsize -1 ) & ~(pgsize-1);
 # ifdef MAP_ANONYMOUS
-       pool = mmap( 0, poolsize, PROT_READ|PROT_WRITE,
+       seg.base = mmap( 0, seg.size, PROT_READ|PROT_WRITE,
 				 MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
 # else /* map /dev/zero instead */
     {	int fd;
@@ -196,44 +328,250 @@ init_pool( size_t n)
 	fd = open("/dev/zero", O_RDWR);
 	if( fd == -1 ) {
 	    log_error("can't open /dev/zero: %s\n", strerror(errno) );
-	    pool = (void*)-1;
+	    seg.base = (void*)-1;
 	}
 	else {
-	    pool = mmap( 0, poolsize, PROT_READ|PROT_WRITE,
+	    seg.base = mmap( 0, seg.size, PROT_READ|PROT_WRITE,
 				      MAP_PRIVATE, fd, 0);
 	    close (fd);
 	}
     }
 # endif
-    if( pool == (void*)-1 )
+    if( seg.base == (void*)-1 ) {
 	log_info("can't mmap pool of %u bytes: %s - using malloc\n",
-			    (unsigned)poolsize, strerror(errno));
+			    (unsigned)seg.size, strerror(errno));
+	seg.base = NULL;
+    }
     else {
-	pool_is_mmapped = 1;
-	pool_okay = 1;
+	seg.is_mmapped = 1;
+#ifdef HAVE_MADVISE
+	/* Keep the pool out of core dumps and out of forked children.
+	 * This is only a precaution; older kernels reject these.  */
+# ifdef MADV_DONTDUMP
+	madvise( seg.base, seg.size, MADV_DONTDUMP );
+# endif
+# ifdef MADV_WIPEONFORK
+	madvise( seg.base, seg.size, MADV_WIPEONFORK );
+# endif
+#endif
     }
 
 #endif
-    if( !pool_okay ) {
-	pool = malloc( poolsize );
-	if( !pool )
-	    log_fatal("can't allocate memory pool of %u bytes\n",
-						       (unsigned)poolsize);
+    if( !seg.base ) {
+	seg.base = malloc( seg.size );
+	if( !seg.base )
+	    return NULL;
+    }
+    seg.is_locked = !lock_pool( seg.base, seg.size );
+    if( trace_fp )
+	seg.trace_ids = calloc( seg.size / BLOCK_ALIGN, sizeof (unsigned) );
+
+    for( i = n_segments; i && segments[i-1].base > seg.base; i-- )
+	segments[i] = segments[i-1];
+    segments[i] = seg;
+    n_segments++;
+    poolsize += seg.size;
+    return &segments[i];
+}
+
+
+static void
+init_pool( size_t n)
+{
+    SEGMENT *seg;
+
+    if( disable_secmem )
+	log_bug("secure memory is disabled");
+
+    if( !(seg = add_segment( n )) )
+	log_fatal("can't allocate memory pool of %u bytes\n",
+						       (unsigned)n);
+    seg->is_primary = 1;
+    pool_okay = 1;
+}
+
+
+/* Unmap the completely free segment SEG and remove it from SEGMENTS.
+ * Its blocks have all been wiped when they were freed.  */
+static void
+release_segment( SEGMENT *seg )
+{
+    int i = seg - segments;
+
+    free( seg->trace_ids );
+#ifdef HAVE_MLOCK
+    if( seg->is_locked )
+	munlock( seg->base, seg->size );
+#endif
+#if HAVE_MMAP
+    if( seg->is_mmapped )
+	munmap( seg->base, seg->size );
+    else
+#endif
+	free( seg->base );
+    poolsize -= seg->size;
+
+    n_segments--;
+    memmove( segments + i, segments + i + 1,
+	     (n_segments - i) * sizeof *segments );
+    memset( segments + n_segments, 0, sizeof *segments );
+}
+
+
+/* Return the segment holding P or NULL.  */
+static SEGMENT *
+find_segment( const void *p )
+{
+    int lo = 0, hi = n_segments, i;
+
+    while( lo < hi ) {
+	i = (lo + hi) / 2;
+	if( (const char*)p < segments[i].base )
+	    hi = i;
+	else if( (const char*)p >= segments[i].base + segments[i].size )
+	    lo = i + 1;
 	else
-	    pool_okay = 1;
+	    return &segments[i];
+    }
+    return NULL;
+}
+
+
+/* Return the size class for a block of SIZE bytes.  */
+static int
+size_class( size_t size )
+{
+    size_t n;
+    int c;
+
+    if( size <= SMALL_LIMIT )
+	return size / BLOCK_ALIGN - 1;
+
+    /* Class N_SMALL_CLASSES takes sizes up to 2*SMALL_LIMIT and each
+     * following class twice as much.  */
+    c = N_SMALL_CLASSES;
+    for( n = (size - 1) / (2 * SMALL_LIMIT); n && c < N_CLASSES - 1; n >>= 1 )
+	c++;
+    return c;
+}
+
+
+/* Return the block following MB in SEG or NULL if MB is the last
+ * one.  */
+static MEMBLOCK *
+next_block( SEGMENT *seg, MEMBLOCK *mb )
+{
+    char *p = (char*)mb + BLOCK_SIZE(mb);
+
+    return p < seg->base + seg->len ? (MEMBLOCK*)(void*)p : NULL;
+}
+
+
+/* Return the block preceding MB or NULL if MB is the first one.  */
+static MEMBLOCK *
+prev_block( MEMBLOCK *mb )
+{
+    return mb->prev_size ? (MEMBLOCK*)(void*)((char*)mb - mb->prev_size)
+			 : NULL;
+}
+
+
+/* Put the free block MB into its list.  */
+static void
+push_block( MEMBLOCK *mb )
+{
+    int c = size_class( mb->size );
+
+    mb->size |= BLOCK_IS_FREE;
+    mb->u.l.prev = NULL;
+    mb->u.l.next = unused_blocks[c];
+    if( mb->u.l.next )
+	mb->u.l.next->u.l.prev = mb;
+    unused_blocks[c] = mb;
+}
+
+
+/* Remove the free block MB from its list.  */
+static void
+unlink_block( MEMBLOCK *mb )
+{
+    mb->size &= ~BLOCK_IS_FREE;
+    if( mb->u.l.prev )
+	mb->u.l.prev->u.l.next = mb->u.l.next;
+    else
+	unused_blocks[size_class( mb->size )] = mb->u.l.next;
+    if( mb->u.l.next )
+	mb->u.l.next->u.l.prev = mb->u.l.prev;
+}
+
+
+/* Remove a free block of at least SIZE bytes from the lists and
+ * return it, or return NULL if there is none.  */
+static MEMBLOCK *
+pop_block( size_t size )
+{
+    MEMBLOCK *mb;
+    int c = size_class( size );
+
+    mb = unused_blocks[c];
+    if( c >= N_SMALL_CLASSES ) {
+	/* The blocks in a large class may be smaller than SIZE.  */
+	while( mb && BLOCK_SIZE(mb) < size )
+	    mb = mb->u.l.next;
     }
-    lock_pool( pool, poolsize );
-    poollen = 0;
+
+    /* All blocks in a higher class are large enough; the caller
+     * splits off the rest.  */
+    for( c++; !mb && c < N_CLASSES; c++ )
+	mb = unused_blocks[c];
+
+    if( mb )
+	unlink_block( mb );
+    return mb;
 }
 
 
-/* concatenate unused blocks */
+/* Store the total size of the free memory at TOTAL, the size of the
+ * largest free block at LARGEST and the number of blocks in the free
+ * lists at NFREE.  The unused end of a segment counts as one free
+ * block but is not in the lists.  */
 static void
-compress_pool(void)
+free_space( size_t *total, size_t *largest, unsigned *nfree )
+{
+    MEMBLOCK *mb;
+    int c, i;
+
+    *total = *largest = 0;
+    *nfree = 0;
+    for( i = 0; i < n_segments; i++ ) {
+	*total += segments[i].size - segments[i].len;
+	if( segments[i].size - segments[i].len > *largest )
+	    *largest = segments[i].size - segments[i].len;
+    }
+    for( c = 0; c < N_CLASSES; c++ )
+	for( mb = unused_blocks[c]; mb; mb = mb->u.l.next ) {
+	    *total += BLOCK_SIZE(mb);
+	    if( BLOCK_SIZE(mb) > *largest )
+		*largest = BLOCK_SIZE(mb);
+	    ++*nfree;
+	}
+}
+
+
+/* Return how fragmented the free memory is in percent: 0 if it is all
+ * in one block, approaching 100 if it is scattered in many small
+ * blocks.  */
+static unsigned
+fragmentation( void )
 {
-    /* fixme: we really should do this */
+    size_t total, largest;
+    unsigned nfree;
+
+    free_space( &total, &largest, &nfree );
+    return total? 100 - (unsigned)(largest * 100 / total) : 0;
 }
 
+
 void
 secmem_set_flags( unsigned flags )
 {
@@ -241,6 +579,7 @@ secmem_set_flags( unsigned flags )
 
     no_warning = flags & 1;
     suspend_warning = flags & 2;
+    wipe_once = flags & 4;
 
     /* and now issue the warning if it is not longer suspended */
     if( was_susp && !suspend_warning && show_warning ) {
@@ -256,9 +595,31 @@ secmem_get_flags(void)
 
     flags  = no_warning      ? 1:0;
     flags |= suspend_warning ? 2:0;
+    flags |= wipe_once       ? 4:0;
     return flags;
 }
 
+/* Start tracing if requested by the envvar PINENTRY_SECMEM_TRACE.  */
+static void
+trace_open( void )
+{
+    const char *s = getenv( "PINENTRY_SECMEM_TRACE" );
+    int i;
+
+    if( !s || !*s || getuid() != geteuid() )
+	return;
+    trace_fp = fopen( s, "w" );
+    if( !trace_fp ) {
+	log_error("can't open secmem trace `%s': %s\n", s, strerror(errno));
+	return;
+    }
+    fputs( "# secmem trace\n", trace_fp );
+    for( i = 0; i < n_segments; i++ )
+	segments[i].trace_ids = calloc( segments[i].size / BLOCK_ALIGN,
+					sizeof (unsigned) );
+}
+
+
 void
 secmem_init( size_t n )
 {
@@ -277,58 +638,261 @@ secmem_init( size_t n )
     else {
 	if( n < DEFAULT_POOLSIZE )
 	    n = DEFAULT_POOLSIZE;
-	if( !pool_okay )
+	if( !pool_okay ) {
 	    init_pool(n);
+	    trace_open();
+	}
 	else
 	    log_error("Oops, secure memory pool already initialized\n");
     }
 }
 
 
-void *
-secmem_malloc( size_t size )
+/* Return the size of the block for N bytes.  Blocks are always a
+ * multiple of BLOCK_ALIGN.  */
+static size_t
+block_size( size_t n )
 {
-    MEMBLOCK *mb, *mb2;
-    int compressed=0;
+    n += sizeof(MEMBLOCK);
+    return ((n + BLOCK_ALIGN - 1) / BLOCK_ALIGN) * BLOCK_ALIGN;
+}
 
-    if( !pool_okay ) {
-	log_info(
-	"operation is not possible without initialized secure memory\n");
-	log_info("(you may have used the wrong program for this task)\n");
-	exit(2);
+
+/* Overwrite the N bytes at P as selected with SECMEM_WIPE_ONCE.  */
+static void
+wipe_block( void *p, size_t n )
+{
+    if( wipe_once ) {
+#ifdef HAVE_EXPLICIT_BZERO
+	explicit_bzero( p, n );
+#else
+	memset_ptr( p, 0, n );
+#endif
+	return;
     }
-    if( show_warning && !suspend_warning ) {
-	show_warning = 0;
-	print_warn();
+
+    /* This does not make much sense: probably this memory is held in the
+     * cache. We do it anyway: */
+    wipememory2(p, 0xff, n );
+    wipememory2(p, 0xaa, n );
+    wipememory2(p, 0x55, n );
+    wipememory2(p, 0x00, n );
+}
+
+
+/* Release the wiped block MB of SEG: merge it with its free
+ * neighbours and put it into the free lists or, if it is the last
+ * block, give it back to the unused end of the segment.  */
+static void
+release_block( SEGMENT *seg, MEMBLOCK *mb )
+{
+    MEMBLOCK *mb2;
+
+    mb2 = next_block( seg, mb );
+    if( mb2 && (mb2->size & BLOCK_IS_FREE) ) {
+	unlink_block( mb2 );
+	mb->size += mb2->size;
+	merged_blocks++;
+    }
+    mb2 = prev_block( mb );
+    if( mb2 && (mb2->size & BLOCK_IS_FREE) ) {
+	unlink_block( mb2 );
+	mb2->size += mb->size;
+	mb = mb2;
+	merged_blocks++;
+    }
+
+    mb2 = next_block( seg, mb );
+    if( !mb2 ) {
+	seg->len -= mb->size;
+	seg->last_size = mb->prev_size;
+	if( !seg->len && !seg->is_primary )
+	    release_segment( seg );
+	return;
     }
+    mb2->prev_size = mb->size;
+    push_block( mb );
+}
 
-    /* blocks are always a multiple of 32 */
-    size += sizeof(MEMBLOCK);
-    size = ((size + 31) / 32) * 32;
 
-  retry:
-    /* try to get it from the used blocks */
-    for(mb = unused_blocks,mb2=NULL; mb; mb2=mb, mb = mb->u.next )
-	if( mb->size >= size ) {
-	    if( mb2 )
-		mb2->u.next = mb->u.next;
-	    else
-		unused_blocks = mb->u.next;
-	    goto leave;
+/* Cut the block MB of SEG down to SIZE bytes and release the rest,
+ * which must already be wiped.  */
+static void
+split_block( SEGMENT *seg, MEMBLOCK *mb, size_t size )
+{
+    MEMBLOCK *mb2;
+
+    if( mb->size == size )
+	return;
+
+    mb2 = (MEMBLOCK*)(void*)((char*)mb + size);
+    mb2->size = mb->size - size;
+    mb2->prev_size = size;
+    mb->size = size;
+    release_block( seg, mb2 );
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Return the blocks in the thread cache TC to the pool and return
+ * their number.  The caller holds the lock.  */
+static int
+flush_cache( THREAD_CACHE *tc )
+{
+    MEMBLOCK *mb;
+    int c, count = 0;
+
+    if( tc->generation == pool_generation )
+	for( c = 0; c < N_CACHED_CLASSES; c++ )
+	    while( tc->n[c] ) {
+		mb = tc->blocks[c][--tc->n[c]];
+		tc->bytes -= mb->size;
+		cur_blocks--;
+		cur_alloced -= mb->size;
+		release_block( find_segment( mb ), mb );
+		count++;
+	    }
+    memset( tc->n, 0, sizeof tc->n );
+    tc->bytes = 0;
+    tc->generation = pool_generation;
+    return count;
+}
+
+
+/* Release the cache of a terminating thread.  */
+static void
+free_cache( void *arg )
+{
+    LOCK_POOL();
+    flush_cache( arg );
+    UNLOCK_POOL();
+    free( arg );
+#ifdef HAVE___THREAD
+    thread_cache = NULL;
+#endif
+}
+
+
+static void
+create_cache_key( void )
+{
+    cache_key_okay = !pthread_key_create( &cache_key, free_cache );
+}
+
+
+/* Return the cache of the calling thread or NULL.  With CREATE set, a
+ * cache is created if the thread has none yet.  */
+static THREAD_CACHE *
+get_cache( int create )
+{
+    THREAD_CACHE *tc;
+
+#ifdef HAVE___THREAD
+    tc = thread_cache;
+#else
+    pthread_once( &cache_once, create_cache_key );
+    tc = cache_key_okay? pthread_getspecific( cache_key ) : NULL;
+#endif
+    if( !tc && create ) {
+	pthread_once( &cache_once, create_cache_key );
+	if( !cache_key_okay )
+	    return NULL;
+	tc = calloc( 1, sizeof *tc );
+	if( !tc )
+	    return NULL;
+	/* The key is only needed to release the cache on thread exit.  */
+	if( pthread_setspecific( cache_key, tc ) ) {
+	    free( tc );
+	    return NULL;
 	}
-    /* allocate a new block */
-    if( (poollen + size <= poolsize) ) {
-	mb = (void*)((char*)pool + poollen);
-	poollen += size;
-	mb->size = size;
+#ifdef HAVE___THREAD
+	thread_cache = tc;
+#endif
+	tc->generation = pool_generation;
     }
-    else if( !compressed ) {
-	compressed=1;
-	compress_pool();
-	goto retry;
+    if( tc && tc->generation != pool_generation ) {
+	/* The blocks went away with secmem_term.  */
+	memset( tc->n, 0, sizeof tc->n );
+	tc->bytes = 0;
+	tc->generation = pool_generation;
     }
-    else
+    return tc;
+}
+
+
+/* Take a block of SIZE bytes from the cache of the calling thread or
+ * return NULL if there is none.  */
+static MEMBLOCK *
+cache_pop( size_t size )
+{
+    THREAD_CACHE *tc;
+    int c = size_class( size );
+
+    if( c >= N_CACHED_CLASSES || !(tc = get_cache( 0 )) || !tc->n[c] )
 	return NULL;
+    tc->bytes -= size;
+    return tc->blocks[c][--tc->n[c]];
+}
+
+
+/* Put the wiped block MB into the cache of the calling thread.
+ * Returns false if there is no room for it.  */
+static int
+cache_push( MEMBLOCK *mb )
+{
+    THREAD_CACHE *tc;
+    int c = size_class( mb->size );
+
+    if( c >= N_CACHED_CLASSES || !(tc = get_cache( 1 ))
+	|| tc->n[c] == CACHE_DEPTH || tc->bytes + mb->size > CACHE_LIMIT )
+	return 0;
+    tc->bytes += mb->size;
+    tc->blocks[c][tc->n[c]++] = mb;
+    return 1;
+}
+#endif /*HAVE_PTHREAD*/
+
+
+/* Take a block of SIZE bytes from the pool.  The caller holds the
+ * lock.  */
+static MEMBLOCK *
+alloc_block( size_t size )
+{
+    MEMBLOCK *mb;
+    SEGMENT *seg;
+    size_t n;
+#ifdef HAVE_PTHREAD
+    THREAD_CACHE *tc;
+#endif
+
+    /* try to get it from the used blocks */
+    mb = pop_block( size );
+    if( mb ) {
+	/* Return the rest to the free lists.  */
+	split_block( find_segment( mb ), mb, size );
+	goto leave;
+    }
+    /* allocate a new block from the end of a segment */
+    for( seg = segments; seg < segments + n_segments; seg++ )
+	if( seg->len + size <= seg->size )
+	    break;
+    if( seg == segments + n_segments ) {
+	/* Map another segment if the limit allows.  */
+	n = size > DEFAULT_POOLSIZE? size : DEFAULT_POOLSIZE;
+	if( poolsize + n > pool_limit() || !(seg = add_segment( n )) ) {
+#ifdef HAVE_PTHREAD
+	    /* The blocks cached by this thread may help.  */
+	    if( (tc = get_cache( 0 )) && flush_cache( tc ) )
+		return alloc_block( size );
+#endif
+	    return NULL;
+	}
+    }
+    mb = (void*)(seg->base + seg->len);
+    seg->len += size;
+    mb->size = size;
+    mb->prev_size = seg->last_size;
+    seg->last_size = size;
 
   leave:
     cur_alloced += mb->size;
@@ -337,6 +901,40 @@ secmem_malloc( size_t size )
 	max_alloced = cur_alloced;
     if( cur_blocks > max_blocks )
 	max_blocks = cur_blocks;
+    return mb;
+}
+
+
+static void *
+do_malloc( size_t size )
+{
+    MEMBLOCK *mb = NULL;
+
+    if( !pool_okay ) {
+	log_info(
+	"operation is not possible without initialized secure memory\n");
+	log_info("(you may have used the wrong program for this task)\n");
+	exit(2);
+    }
+    if( show_warning && !suspend_warning ) {
+	show_warning = 0;
+	print_warn();
+    }
+
+    size = block_size( size );
+
+#ifdef HAVE_PTHREAD
+    mb = cache_pop( size );
+#endif
+    if( !mb ) {
+	LOCK_POOL();
+	mb = alloc_block( size );
+	if( !mb )
+	    failed_allocs++;
+	UNLOCK_POOL();
+	if( !mb )
+	    return NULL;
+    }
 
     memset (&mb->u.aligned.c, 0,
 	    size - (size_t) &((struct memblock_struct *) 0)->u.aligned.c);
@@ -345,32 +943,90 @@ secmem_malloc( size_t size )
 }
 
 
-void *
-secmem_realloc( void *p, size_t newsize )
+static void do_free( void *a );
+
+
+/* Try to resize the block MB to SIZE bytes without moving it.  The
+ * added memory is zeroed and released memory is wiped.  Returns true
+ * on success.  */
+static int
+resize_in_place( MEMBLOCK *mb, size_t size )
+{
+    SEGMENT *seg = find_segment( mb );
+    MEMBLOCK *mb2;
+    size_t oldsize = mb->size;
+
+    if( size < oldsize ) {
+	wipe_block( (char*)mb + size, oldsize - size );
+	split_block( seg, mb, size );
+	cur_alloced -= oldsize - size;
+	return 1;
+    }
+
+    mb2 = next_block( seg, mb );
+    if( !mb2 ) {
+	/* The last block may take from the unused end.  */
+	if( seg->len - oldsize + size > seg->size )
+	    return 0;
+	seg->len += size - oldsize;
+	seg->last_size = size;
+	mb->size = size;
+    }
+    else if( (mb2->size & BLOCK_IS_FREE) && oldsize + BLOCK_SIZE(mb2) >= size ) {
+	/* Take the following free block and release what is not
+	 * needed.  A free block is never the last one.  */
+	unlink_block( mb2 );
+	mb->size += mb2->size;
+	next_block( seg, mb )->prev_size = mb->size;
+	split_block( seg, mb, size );
+    }
+    else
+	return 0;
+
+    memset( (char*)mb + oldsize, 0, size - oldsize );
+    cur_alloced += size - oldsize;
+    if( cur_alloced > max_alloced )
+	max_alloced = cur_alloced;
+    return 1;
+}
+
+
+static void *
+do_realloc( void *p, size_t newsize )
 {
     MEMBLOCK *mb;
     size_t size;
+    int resized;
     void *a;
 
     if (! p)
-      return secmem_malloc(newsize);
+      return do_malloc(newsize);
 
     mb = (MEMBLOCK*) (void *) ((char *) p
                                - offsetof (MEMBLOCK, u.aligned.c));
 
-    size = mb->size;
-    if( newsize < size )
-	return p; /* it is easier not to shrink the memory */
-    a = secmem_malloc( newsize );
-    memcpy(a, p, size);
-    memset((char*)a+size, 0, newsize-size);
-    secmem_free(p);
+    /* Growing into the unused end of the segment or into a following
+     * free block and shrinking neither copy nor wipe the data.  */
+    if( block_size( newsize ) == mb->size )
+	return p;
+    LOCK_POOL();
+    resized = resize_in_place( mb, block_size( newsize ) );
+    UNLOCK_POOL();
+    if( resized )
+	return p;
+
+    a = do_malloc( newsize );
+    if( !a )
+	return NULL;
+    size = mb->size - offsetof (MEMBLOCK, u.aligned.c);
+    memcpy(a, p, size < newsize? size : newsize);
+    do_free(p);
     return a;
 }
 
 
-void
-secmem_free( void *a )
+static void
+do_free( void *a )
 {
     MEMBLOCK *mb;
     size_t size;
@@ -380,45 +1036,174 @@ secmem_free( void *a )
 
     mb = (MEMBLOCK*) (void *) ((char*)a
                                - offsetof (MEMBLOCK, u.aligned.c));
+    /* The header holds nothing secret and its SIZE is only changed by
+     * the owner of the block, so wiping it does not need the lock.  */
     size = mb->size;
-    /* This does not make much sense: probably this memory is held in the
-     * cache. We do it anyway: */
-    wipememory2(mb, 0xff, size );
-    wipememory2(mb, 0xaa, size );
-    wipememory2(mb, 0x55, size );
-    wipememory2(mb, 0x00, size );
-    mb->size = size;
-    mb->u.next = unused_blocks;
-    unused_blocks = mb;
+    wipe_block( &mb->u, size - offsetof (MEMBLOCK, u) );
+#ifdef HAVE_PTHREAD
+    if( cache_push( mb ) )
+	return;
+#endif
+
+    LOCK_POOL();
     cur_blocks--;
     cur_alloced -= size;
+    release_block( find_segment( mb ), mb );
+    UNLOCK_POOL();
+}
+
+/* Return the slot for the trace ID of the block at P or NULL.  The
+ * caller holds the lock.  */
+static unsigned *
+trace_slot( const void *p )
+{
+    SEGMENT *seg = find_segment( p );
+
+    if( !seg || !seg->trace_ids )
+	return NULL;
+    return &seg->trace_ids[((const char*)p - seg->base) / BLOCK_ALIGN];
+}
+
+
+/* Remove the trace ID from the block at P and return it.  It is taken
+ * before the block is released so that another thread may not
+ * reuse the block with the old ID.  */
+static unsigned
+trace_take( const void *p )
+{
+    unsigned *slot;
+    unsigned id = 0;
+
+    LOCK_POOL();
+    if( (slot = trace_slot( p )) ) {
+	id = *slot;
+	*slot = 0;
+    }
+    UNLOCK_POOL();
+    return id;
+}
+
+
+/* Write the trace line for OP with ID and SIZE and attach ID to the
+ * block at P.  For OP 'm' a new ID is used; for OP 0 only the ID is
+ * attached.  */
+static void
+trace_put( int op, unsigned id, const void *p, size_t size )
+{
+    unsigned *slot;
+
+    LOCK_POOL();
+    if( op == 'm' )
+	id = ++trace_next_id;
+    if( op == 'f' )
+	fprintf( trace_fp, "f %u\n", id );
+    else if( op )
+	fprintf( trace_fp, "%c %u %lu\n", op, id, (unsigned long)size );
+    if( p && (slot = trace_slot( p )) )
+	*slot = id;
+    UNLOCK_POOL();
+}
+
+
+void *
+secmem_malloc( size_t size )
+{
+    void *p = do_malloc( size );
+
+    if( trace_fp && p )
+	trace_put( 'm', 0, p, size );
+    return p;
 }
 
+
+void *
+secmem_realloc( void *a, size_t newsize )
+{
+    unsigned id;
+    void *p;
+
+    if( !trace_fp || !a )
+	return a? do_realloc( a, newsize ) : secmem_malloc( newsize );
+
+    id = trace_take( a );
+    p = do_realloc( a, newsize );
+    if( p )
+	trace_put( 'r', id, p, newsize );
+    else
+	trace_put( 0, id, a, 0 );
+    return p;
+}
+
+
+void
+secmem_free( void *a )
+{
+    if( a && trace_fp )
+	trace_put( 'f', trace_take( a ), NULL, 0 );
+    do_free( a );
+}
+
+
 int
 m_is_secure( const void *p )
 {
-    return p >= pool && p < (void*)((char*)pool+poolsize);
+    int yes;
+
+    LOCK_POOL();
+    yes = !!find_segment( p );
+    UNLOCK_POOL();
+    return yes;
 }
 
 void
 secmem_term(void)
 {
+    SEGMENT *seg;
+
     if( !pool_okay )
 	return;
 
-    wipememory2( pool, 0xff, poolsize);
-    wipememory2( pool, 0xaa, poolsize);
-    wipememory2( pool, 0x55, poolsize);
-    wipememory2( pool, 0x00, poolsize);
+    LOCK_POOL();
+    for( seg = segments; seg < segments + n_segments; seg++ ) {
+	free( seg->trace_ids );
+	wipe_block( seg->base, seg->size );
 #if HAVE_MMAP
-    if( pool_is_mmapped )
-	munmap( pool, poolsize );
+	if( seg->is_mmapped )
+	    munmap( seg->base, seg->size );
+	else
 #endif
-    pool = NULL;
+	    free( seg->base );
+    }
+    memset( segments, 0, sizeof segments );
+    n_segments = 0;
     pool_okay = 0;
     poolsize=0;
-    poollen=0;
-    unused_blocks=NULL;
+    memset( unused_blocks, 0, sizeof unused_blocks );
+    max_alloced = cur_alloced = 0;
+    max_blocks = cur_blocks = 0;
+    failed_allocs = merged_blocks = 0;
+    if( trace_fp ) {
+	fclose( trace_fp );
+	trace_fp = NULL;
+	trace_next_id = 0;
+    }
+#ifdef HAVE_PTHREAD
+    pool_generation++;
+#endif
+    UNLOCK_POOL();
+}
+
+
+/* Return the used length of all segments.  */
+static size_t
+poollen( void )
+{
+    size_t n = 0;
+    int i;
+
+    for( i = 0; i < n_segments; i++ )
+	n += segments[i].len;
+    return n;
 }
 
 
@@ -427,15 +1212,62 @@ secmem_dump_stats(void)
 {
     if( disable_secmem )
 	return;
+    LOCK_POOL();
     fprintf(stderr,
-		"secmem usage: %u/%u bytes in %u/%u blocks of pool %lu/%lu\n",
+		"secmem usage: %u/%u bytes in %u/%u blocks of pool %lu/%lu"
+		" in %d segments (%u%% fragmented)\n",
 		cur_alloced, max_alloced, cur_blocks, max_blocks,
-		(ulong)poollen, (ulong)poolsize );
+		(ulong)poollen(), (ulong)poolsize, n_segments,
+		fragmentation() );
+    UNLOCK_POOL();
+}
+
+
+/* Set the size up to which the pool may grow.  The pool never grows
+ * beyond RLIMIT_MEMLOCK.  */
+void
+secmem_set_max_size (size_t n)
+{
+  max_poolsize = n;
+}
+
+
+/* Fill STATS with the current counters of the pool.  */
+void
+secmem_get_stats (struct secmem_stats *stats)
+{
+  int i;
+
+  memset (stats, 0, sizeof *stats);
+  if (!pool_okay)
+    return;
+
+  LOCK_POOL ();
+  stats->cur_alloced = cur_alloced;
+  stats->max_alloced = max_alloced;
+  stats->cur_blocks = cur_blocks;
+  stats->max_blocks = max_blocks;
+  stats->poolsize = poolsize;
+  stats->poollen = poollen ();
+  stats->segments = n_segments;
+  for (i = 0; i < n_segments; i++)
+    if (segments[i].is_locked)
+      stats->locked_segments++;
+  free_space (&stats->free_bytes, &stats->largest_free, &stats->free_blocks);
+  stats->failed_allocs = failed_allocs;
+  stats->merged_blocks = merged_blocks;
+  UNLOCK_POOL ();
 }
 
 
 size_t
 secmem_get_max_size (void)
 {
-  return poolsize;
+  size_t limit = pool_limit ();
+  size_t n;
+
+  LOCK_POOL ();
+  n = limit > poolsize? limit : poolsize;
+  UNLOCK_POOL ();
+  return n;
 }
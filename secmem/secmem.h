@@ -34,6 +34,24 @@ extern "C" {
 #define SECMEM_WARN		0
 #define SECMEM_DONT_WARN	1
 #define SECMEM_SUSPEND_WARN	2
+#define SECMEM_WIPE_ONCE	4  /* wipe with one pass of zeros */
+
+/* Counters returned by secmem_get_stats.  */
+struct secmem_stats {
+    size_t cur_alloced;		/* bytes in allocated blocks */
+    size_t max_alloced;		/* peak of cur_alloced */
+    unsigned cur_blocks;	/* allocated blocks */
+    unsigned max_blocks;	/* peak of cur_blocks */
+    size_t poolsize;		/* allocated length of all segments */
+    size_t poollen;		/* used length of all segments */
+    int segments;
+    int locked_segments;	/* segments locked into memory */
+    size_t free_bytes;		/* in free blocks and unused ends */
+    size_t largest_free;	/* free block or unused end */
+    unsigned free_blocks;	/* in the free lists */
+    unsigned long failed_allocs;
+    unsigned long merged_blocks; /* free neighbours merged on free */
+};
 
 void secmem_init( size_t npool );
 void secmem_term( void );
@@ -44,7 +62,9 @@ int  m_is_secure( const void *p );
 void secmem_dump_stats(void);
 void secmem_set_flags( unsigned flags );
 unsigned secmem_get_flags(void);
+void secmem_set_max_size (size_t n);
 size_t secmem_get_max_size (void);
+void secmem_get_stats (struct secmem_stats *stats);
 
 #if 0
 {
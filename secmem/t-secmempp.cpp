@@ -0,0 +1,74 @@
+/* t-secmempp.cpp - Test for the secure memory strings.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#include "secmem++.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+static int errors;
+
+// Convert the UTF-16 text S of N code units and compare the result
+// with the UTF-8 text EXPECTED.
+static void check_utf16( const char * what, const char16_t * s, std::size_t n,
+                         std::string_view expected )
+{
+    const secmem::string result = secmem::string::from_utf16( s, n );
+
+    if ( result.view() != expected ) {
+        std::fprintf( stderr, "%s: got %zu bytes, expected %zu\n",
+                      what, result.size(), expected.size() );
+        errors++;
+    }
+    if ( result.c_str()[result.size()] ) {
+        std::fprintf( stderr, "%s: not Nul terminated\n", what );
+        errors++;
+    }
+}
+
+int main()
+{
+    secmem_init( 16384 );
+    secmem_set_flags( secmem_get_flags() | SECMEM_DONT_WARN );
+
+    check_utf16( "empty", u"", 0, "" );
+    check_utf16( "ascii", u"abc", 3, "abc" );
+    check_utf16( "bmp", u"é€", 2, "\xc3\xa9\xe2\x82\xac" );
+    check_utf16( "pair", u"\U0001f600", 2, "\xf0\x9f\x98\x80" );
+
+    static const char16_t high[] = { 'a', 0xd83d };
+    check_utf16( "lone high surrogate", high, 2, "a\xef\xbf\xbd" );
+    static const char16_t low[] = { 0xde00, 'a' };
+    check_utf16( "lone low surrogate", low, 2, "\xef\xbf\xbd" "a" );
+    static const char16_t swapped[] = { 0xde00, 0xd83d };
+    check_utf16( "swapped pair", swapped, 2, "\xef\xbf\xbd\xef\xbf\xbd" );
+
+    // Appending nothing to a string must keep it intact.
+    {
+        secmem::string s{ std::string_view{ "abc" } };
+        s.append_utf16( u"", 0 );
+        if ( s.view() != "abc" ) {
+            std::fprintf( stderr, "append of nothing changed the string\n" );
+            errors++;
+        }
+    }
+
+    secmem_term();
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -429,6 +429,17 @@ void SecTQString::setLength( uint newLen )
 	 ( newLen * 4 < d->maxl && d->maxl > 4 ) ) {
 	// detach, grow or shrink
 	uint newMax = computeNewMax( newLen );
+	if ( d->count == 1 && d->unicode ) {
+	    // secmem_realloc grows and shrinks in place if it can
+	    TQChar* nd = (TQChar*) ::secmem_realloc( d->unicode,
+						   sizeof(TQChar) * newMax );
+	    if ( nd ) {
+		d->unicode = nd;
+		d->len = newLen;
+		d->maxl = newMax;
+	    }
+	    return;
+	}
 	TQChar* nd = QT_ALLOC_SECTQCHAR_VEC( newMax );
 	if ( nd ) {
 	    uint len = TQMIN( d->len, newLen );
@@ -779,9 +790,9 @@ uchar *SecTQString::utf8() const
 	}
 	++ch;
     }
-    /* FIXME: secmem_realloc doesn't release extra memory.  */
     *cursor = '\0';
-    return rstr;
+    /* Release what is not needed; this shrinks in place.  */
+    return (uchar*) ::secmem_realloc (rstr, cursor - rstr + 1);
 }
 
 
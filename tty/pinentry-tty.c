@@ -355,7 +355,7 @@ read_password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 	  char *tmp = secmem_realloc (buffer, new_len);
 	  if (! tmp)
 	    {
-	      secmem_free (tmp);
+	      secmem_free (buffer);
 	      return NULL;
 	    }
 	  buffer = tmp;